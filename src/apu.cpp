@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "apu.h"
+#include "state.h"
+
+// reference: https://gbdev.gg8.se/wiki/articles/Gameboy_sound_hardware
+
+// bits that always read back as 1, indexed from 0xFF10
+const std::array<uint8_t, 0x30> APU_READ_MASK = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF,
+    0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+const std::array<std::array<int, 8>, 4> DUTY_TABLE = {{
+    {0, 0, 0, 0, 0, 0, 0, 1},
+    {1, 0, 0, 0, 0, 0, 0, 1},
+    {1, 0, 0, 0, 0, 1, 1, 1},
+    {0, 1, 1, 1, 1, 1, 1, 0},
+}};
+
+const std::array<int, 8> NOISE_DIVISORS = {8, 16, 32, 48, 64, 80, 96, 112};
+
+const int NR10 = 0x00;
+const int NR11 = 0x01;
+const int NR12 = 0x02;
+const int NR13 = 0x03;
+const int NR14 = 0x04;
+const int NR21 = 0x06;
+const int NR22 = 0x07;
+const int NR23 = 0x08;
+const int NR24 = 0x09;
+const int NR30 = 0x0A;
+const int NR31 = 0x0B;
+const int NR32 = 0x0C;
+const int NR33 = 0x0D;
+const int NR34 = 0x0E;
+const int NR41 = 0x10;
+const int NR42 = 0x11;
+const int NR43 = 0x12;
+const int NR44 = 0x13;
+const int NR50 = 0x14;
+const int NR51 = 0x15;
+const int NR52 = 0x16;
+const int WAVE_RAM = 0x20;
+
+// the frame sequencer clocks length/envelope/sweep at 512 Hz
+const int FRAME_SEQUENCER_PERIOD = 8192;
+// 4 channels * max volume 15 * max master volume 8 stays under int16 range
+const int VOLUME_UNIT = 48;
+// output buffer capacity, a little over 4 frames at 48 kHz
+const int SAMPLE_CAPACITY = 4096;
+
+APU::APU() : left(SAMPLE_CAPACITY), right(SAMPLE_CAPACITY) {
+    power = false;
+    muted = false;
+    regs.fill(0);
+    channels = {};
+    last_left.fill(0);
+    last_right.fill(0);
+    fs_timer = FRAME_SEQUENCER_PERIOD;
+    fs_step = 0;
+    time = 0;
+    pending_cycles = 0;
+    run_ns = 0;
+    emulated_cycles = 0;
+    set_sample_rate(48000);
+}
+
+void APU::set_sample_rate(double sample_rate) {
+    left.set_rates(CLOCK_RATE, sample_rate);
+    right.set_rates(CLOCK_RATE, sample_rate);
+}
+
+uint8_t APU::read(int address) {
+    int reg = address - 0xFF10;
+    run();
+    if (reg == NR52) {
+        uint8_t status = (power ? 0x80 : 0);
+        for (int i = 0; i < 4; i++) {
+            if (channels[i].enabled)
+                status |= 1 << i;
+        }
+        return status | APU_READ_MASK[reg];
+    }
+    return regs.at(reg) | APU_READ_MASK.at(reg);
+}
+
+void APU::write(int address, uint8_t val) {
+    int reg = address - 0xFF10;
+    run();
+
+    if (reg >= WAVE_RAM) {
+        regs.at(reg) = val;
+        return;
+    }
+    if (!power && reg != NR52) {
+        // registers are read-only while the APU is off
+        return;
+    }
+    regs.at(reg) = val;
+
+    ApuChannel& ch1 = channels[0];
+    ApuChannel& ch2 = channels[1];
+    ApuChannel& ch3 = channels[2];
+    ApuChannel& ch4 = channels[3];
+
+    switch (reg) {
+    case NR10:
+        ch1.sweep_period = (val >> 4) & 0b111;
+        ch1.sweep_negate = val & 0b1000;
+        ch1.sweep_shift = val & 0b111;
+        break;
+    case NR11: case NR21: {
+        ApuChannel& ch = reg == NR11 ? ch1 : ch2;
+        ch.duty = val >> 6;
+        ch.length = 64 - (val & 0x3F);
+        break;
+    }
+    case NR12: case NR22: case NR42: {
+        ApuChannel& ch = reg == NR12 ? ch1 : (reg == NR22 ? ch2 : ch4);
+        ch.env_initial = val >> 4;
+        ch.env_up = val & 0b1000;
+        ch.env_period = val & 0b111;
+        ch.dac = (val & 0xF8) != 0;
+        if (!ch.dac)
+            ch.enabled = false;
+        break;
+    }
+    case NR13: case NR23: case NR33: {
+        ApuChannel& ch = reg == NR13 ? ch1 : (reg == NR23 ? ch2 : ch3);
+        ch.freq = (ch.freq & 0x700) | val;
+        break;
+    }
+    case NR14: case NR24: case NR34: case NR44: {
+        int index = reg == NR14 ? 0 : (reg == NR24 ? 1 : (reg == NR34 ? 2 : 3));
+        ApuChannel& ch = channels[index];
+        if (index != 3)
+            ch.freq = (ch.freq & 0xFF) | ((val & 0b111) << 8);
+        ch.length_enabled = val & 0x40;
+        if (val & 0x80)
+            trigger(index);
+        break;
+    }
+    case NR30:
+        ch3.dac = val & 0x80;
+        if (!ch3.dac)
+            ch3.enabled = false;
+        break;
+    case NR31:
+        ch3.length = 256 - val;
+        break;
+    case NR32:
+        ch3.volume_code = (val >> 5) & 0b11;
+        break;
+    case NR41:
+        ch4.length = 64 - (val & 0x3F);
+        break;
+    case NR43:
+        ch4.clock_shift = val >> 4;
+        ch4.width_mode = val & 0b1000;
+        ch4.divisor_code = val & 0b111;
+        break;
+    case NR52:
+        power = val & 0x80;
+        if (!power) {
+            for (int i = 0; i < NR52; i++)
+                regs.at(i) = 0;
+            channels = {};
+        }
+        break;
+    default:
+        break;
+    }
+
+    update_all(time);
+}
+
+void APU::trigger(int index) {
+    ApuChannel& ch = channels[index];
+    ch.enabled = ch.dac;
+    if (ch.length == 0)
+        ch.length = index == 2 ? 256 : 64;
+
+    if (index == 2) {
+        ch.timer = (2048 - ch.freq) * 2;
+        ch.position = 0;
+        return;
+    }
+
+    ch.volume = ch.env_initial;
+    ch.env_timer = ch.env_period;
+    if (index == 3) {
+        ch.timer = NOISE_DIVISORS[ch.divisor_code] << ch.clock_shift;
+        ch.lfsr = 0x7FFF;
+    } else {
+        ch.timer = (2048 - ch.freq) * 4;
+    }
+
+    if (index == 0) {
+        ch.shadow_freq = ch.freq;
+        ch.sweep_timer = ch.sweep_period ? ch.sweep_period : 8;
+        ch.sweep_enabled = ch.sweep_period || ch.sweep_shift;
+        if (ch.sweep_shift)
+            sweep_calc();
+    }
+}
+
+int APU::sweep_calc() {
+    ApuChannel& ch = channels[0];
+    int delta = ch.shadow_freq >> ch.sweep_shift;
+    int freq = ch.sweep_negate ? ch.shadow_freq - delta : ch.shadow_freq + delta;
+    if (freq > 2047)
+        ch.enabled = false;
+    return freq;
+}
+
+int APU::channel_output(int index) {
+    const ApuChannel& ch = channels[index];
+    if (!ch.enabled || !ch.dac)
+        return 0;
+    if (index < 2) {
+        return DUTY_TABLE[ch.duty][ch.duty_pos] ? ch.volume : 0;
+    } else if (index == 2) {
+        if (ch.volume_code == 0)
+            return 0;
+        uint8_t byte = regs[WAVE_RAM + ch.position / 2];
+        int sample = (ch.position & 1) ? (byte & 0xF) : (byte >> 4);
+        return sample >> (ch.volume_code - 1);
+    } else {
+        return (~ch.lfsr & 1) ? ch.volume : 0;
+    }
+}
+
+void APU::update_output(int index, uint32_t at) {
+    if (muted)
+        return;
+    int value = channel_output(index);
+    uint8_t nr50 = regs[NR50];
+    uint8_t nr51 = regs[NR51];
+    int l = (nr51 & (0x10 << index)) ? value * (((nr50 >> 4) & 0b111) + 1) : 0;
+    int r = (nr51 & (0x01 << index)) ? value * ((nr50 & 0b111) + 1) : 0;
+    if (l != last_left[index]) {
+        left.add_delta(at, (l - last_left[index]) * VOLUME_UNIT);
+        last_left[index] = l;
+    }
+    if (r != last_right[index]) {
+        right.add_delta(at, (r - last_right[index]) * VOLUME_UNIT);
+        last_right[index] = r;
+    }
+}
+
+void APU::update_all(uint32_t at) {
+    for (int i = 0; i < 4; i++)
+        update_output(i, at);
+}
+
+void APU::run_square(int index, uint32_t start, uint32_t end) {
+    ApuChannel& ch = channels[index];
+    uint32_t period = (2048 - ch.freq) * 4;
+    uint32_t t = start + ch.timer;
+    if (t < end) {
+        if (!ch.enabled || ch.volume == 0) {
+            // silent, so there are no deltas to emit, just keep the phase right
+            uint32_t steps = (end - t) / period + 1;
+            ch.duty_pos = (ch.duty_pos + steps) & 0b111;
+            t += steps * period;
+        } else {
+            const std::array<int, 8>& duty = DUTY_TABLE[ch.duty];
+            while (t < end) {
+                int prev = duty[ch.duty_pos];
+                ch.duty_pos = (ch.duty_pos + 1) & 0b111;
+                if (duty[ch.duty_pos] != prev)
+                    update_output(index, t);
+                t += period;
+            }
+        }
+    }
+    ch.timer = t - end;
+}
+
+void APU::run_wave(uint32_t start, uint32_t end) {
+    ApuChannel& ch = channels[2];
+    uint32_t period = (2048 - ch.freq) * 2;
+    uint32_t t = start + ch.timer;
+    if (t < end) {
+        if (!ch.enabled || ch.volume_code == 0) {
+            uint32_t steps = (end - t) / period + 1;
+            ch.position = (ch.position + steps) & 31;
+            t += steps * period;
+        } else {
+            while (t < end) {
+                ch.position = (ch.position + 1) & 31;
+                update_output(2, t);
+                t += period;
+            }
+        }
+    }
+    ch.timer = t - end;
+}
+
+void APU::run_noise(uint32_t start, uint32_t end) {
+    ApuChannel& ch = channels[3];
+    uint32_t period = NOISE_DIVISORS[ch.divisor_code] << ch.clock_shift;
+    uint32_t t = start + ch.timer;
+    if (t < end) {
+        if (!ch.enabled || ch.clock_shift >= 14) {
+            // the lfsr does not advance (or isn't audible until the next trigger reseeds it)
+            uint32_t steps = (end - t) / period + 1;
+            t += steps * period;
+        } else {
+            while (t < end) {
+                int bit = (ch.lfsr ^ (ch.lfsr >> 1)) & 1;
+                ch.lfsr = (ch.lfsr >> 1) | (bit << 14);
+                if (ch.width_mode)
+                    ch.lfsr = (ch.lfsr & ~(1 << 6)) | (bit << 6);
+                if (ch.volume)
+                    update_output(3, t);
+                t += period;
+            }
+        }
+    }
+    ch.timer = t - end;
+}
+
+void APU::run_channels(uint32_t start, uint32_t end) {
+    run_square(0, start, end);
+    run_square(1, start, end);
+    run_wave(start, end);
+    run_noise(start, end);
+}
+
+void APU::clock_length() {
+    for (ApuChannel& ch : channels) {
+        if (ch.length_enabled && ch.length > 0) {
+            ch.length--;
+            if (ch.length == 0)
+                ch.enabled = false;
+        }
+    }
+}
+
+void APU::clock_envelope() {
+    for (int i : {0, 1, 3}) {
+        ApuChannel& ch = channels[i];
+        if (ch.env_period == 0)
+            continue;
+        if (--ch.env_timer <= 0) {
+            ch.env_timer = ch.env_period;
+            if (ch.env_up && ch.volume < 15)
+                ch.volume++;
+            else if (!ch.env_up && ch.volume > 0)
+                ch.volume--;
+        }
+    }
+}
+
+void APU::clock_sweep() {
+    ApuChannel& ch = channels[0];
+    if (--ch.sweep_timer > 0)
+        return;
+    ch.sweep_timer = ch.sweep_period ? ch.sweep_period : 8;
+    if (ch.sweep_enabled && ch.sweep_period) {
+        int freq = sweep_calc();
+        if (freq <= 2047 && ch.sweep_shift) {
+            ch.shadow_freq = freq;
+            ch.freq = freq;
+            sweep_calc();
+        }
+    }
+}
+
+void APU::clock_frame_sequencer(uint32_t at) {
+    if (fs_step % 2 == 0)
+        clock_length();
+    if (fs_step == 2 || fs_step == 6)
+        clock_sweep();
+    if (fs_step == 7)
+        clock_envelope();
+    fs_step = (fs_step + 1) % 8;
+    update_all(at);
+}
+
+void APU::run() {
+    if (pending_cycles == 0)
+        return;
+#ifdef GB_PROFILE
+    // two clock reads per register access, only worth it when profiling
+    auto start = std::chrono::steady_clock::now();
+#endif
+
+    uint32_t end = time + pending_cycles;
+    while (time < end) {
+        // channel state only changes on frame sequencer steps, so run up to the next one
+        uint32_t next = std::min(end, time + fs_timer);
+        if (power)
+            run_channels(time, next);
+        fs_timer -= next - time;
+        time = next;
+        if (fs_timer == 0) {
+            fs_timer = FRAME_SEQUENCER_PERIOD;
+            if (power)
+                clock_frame_sequencer(time);
+        }
+    }
+    emulated_cycles += pending_cycles;
+    pending_cycles = 0;
+
+#ifdef GB_PROFILE
+    auto stop = std::chrono::steady_clock::now();
+    run_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+#endif
+}
+
+void APU::end_frame() {
+    run();
+    if (!muted) {
+        left.end_frame(time);
+        right.end_frame(time);
+    }
+    time = 0;
+}
+
+int APU::samples_avail() const {
+    return left.samples_avail();
+}
+
+int APU::read_samples(int16_t* out, int count) {
+    int n = left.read_samples(out, count, 2);
+    right.read_samples(out + 1, n, 2);
+    return n;
+}
+
+void APU::clear_samples() {
+    left.clear();
+    right.clear();
+    last_left.fill(0);
+    last_right.fill(0);
+    update_all(0);
+}
+
+void APU::save_state(StateWriter& state) {
+    state.write(power);
+    state.write(regs);
+    state.write(channels);
+    state.write(fs_timer);
+    state.write(fs_step);
+    state.write(time);
+    state.write(pending_cycles);
+}
+
+void APU::load_state(StateReader& state) {
+    state.read(power);
+    state.read(regs);
+    state.read(channels);
+    state.read(fs_timer);
+    state.read(fs_step);
+    state.read(time);
+    state.read(pending_cycles);
+    // levels are now whatever the loaded channels output, step the output there
+    update_all(time);
+}
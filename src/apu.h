@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "blip_buffer.h"
+
+class StateWriter;
+class StateReader;
+
+// state for one sound channel, not every field is used by every channel type
+struct ApuChannel {
+    bool enabled;
+    bool dac;
+    int freq;
+    int timer;
+    int length;
+    bool length_enabled;
+
+    // square channels
+    int duty;
+    int duty_pos;
+
+    // volume envelope (square and noise)
+    int volume;
+    int env_initial;
+    bool env_up;
+    int env_period;
+    int env_timer;
+
+    // frequency sweep (channel 1 only)
+    int sweep_period;
+    bool sweep_negate;
+    int sweep_shift;
+    int sweep_timer;
+    bool sweep_enabled;
+    int shadow_freq;
+
+    // wave channel
+    int position;
+    int volume_code;
+
+    // noise channel
+    int clock_shift;
+    bool width_mode;
+    int divisor_code;
+    uint16_t lfsr;
+};
+
+class APU {
+ public:
+    static const int CLOCK_RATE = 4194304;
+
+    APU();
+    uint8_t read(int address);
+    void write(int address, uint8_t val);
+
+    // cheap enough to call after every instruction, the channels only
+    // catch up when a register is touched or the frame ends
+    void tick(int cycles) {
+        pending_cycles += cycles;
+    }
+
+    void set_sample_rate(double sample_rate);
+    void end_frame();
+    int samples_avail() const;
+    // reads interleaved stereo frames
+    int read_samples(int16_t* out, int count);
+    void clear_samples();
+
+    // while muted the channels still run but nothing reaches the output buffers,
+    // used for frames that get rolled back (run-ahead)
+    void set_muted(bool muted) { this->muted = muted; }
+
+    // the output buffers are not part of the state, only what the channels are doing
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
+
+    // host cost of synthesis, for tuning (run_ns only in GB_PROFILE builds)
+    uint64_t run_ns;
+    uint64_t emulated_cycles;
+
+ private:
+    bool power;
+    bool muted;
+    std::array<uint8_t, 0x30> regs;
+    std::array<ApuChannel, 4> channels;
+    std::array<int, 4> last_left;
+    std::array<int, 4> last_right;
+    int fs_timer;
+    int fs_step;
+
+    uint32_t time;
+    uint32_t pending_cycles;
+
+    BlipBuffer left;
+    BlipBuffer right;
+
+    void run();
+    void run_channels(uint32_t start, uint32_t end);
+    void run_square(int index, uint32_t start, uint32_t end);
+    void run_wave(uint32_t start, uint32_t end);
+    void run_noise(uint32_t start, uint32_t end);
+    void clock_frame_sequencer(uint32_t at);
+    void clock_length();
+    void clock_envelope();
+    void clock_sweep();
+    int sweep_calc();
+
+    void trigger(int index);
+    int channel_output(int index);
+    void update_output(int index, uint32_t at);
+    void update_all(uint32_t at);
+};
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "apu.h"
+#include "audio_output.h"
+
+// stereo int16 frames
+const int BYTES_PER_FRAME = 4;
+// how far the resample ratio may drift from nominal, small enough that the pitch change is inaudible
+const double MAX_RATE_DELTA = 0.005;
+// the queue is considered full at twice this, so the target is half-full
+const int TARGET_QUEUED_FRAMES = 2048;
+
+AudioOutput::AudioOutput() {
+    is_open = false;
+    underruns = 0;
+    device = 0;
+    sample_rate = 0;
+    target_bytes = TARGET_QUEUED_FRAMES * BYTES_PER_FRAME;
+    started = false;
+}
+
+bool AudioOutput::open(APU& apu, int rate) {
+    SDL_AudioSpec want = {};
+    SDL_AudioSpec have = {};
+    want.freq = rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = 512;
+    want.callback = nullptr;
+
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (device == 0) {
+        fprintf(stderr, "failed to open audio device, falling back to timer pacing: %s\n", SDL_GetError());
+        return false;
+    }
+    sample_rate = have.freq;
+    apu.set_sample_rate(sample_rate);
+    samples.resize(4096 * 2);
+    SDL_PauseAudioDevice(device, 0);
+    is_open = true;
+    return true;
+}
+
+void AudioOutput::close() {
+    if (is_open) {
+        SDL_CloseAudioDevice(device);
+        is_open = false;
+    }
+}
+
+void AudioOutput::push(APU& apu) {
+    uint32_t queued = SDL_GetQueuedAudioSize(device);
+    if (queued == 0 && started)
+        underruns++;
+
+    int count = apu.read_samples(samples.data(), samples.size() / 2);
+    SDL_QueueAudio(device, samples.data(), count * BYTES_PER_FRAME);
+    started = true;
+
+    // dynamic rate control: produce slightly more samples per emulated frame
+    // when the queue is below half-full and slightly fewer when above
+    double fill = std::min(1.0, (double)(queued + count * BYTES_PER_FRAME) / (2 * target_bytes));
+    apu.set_sample_rate(sample_rate * (1.0 + (1.0 - 2.0 * fill) * MAX_RATE_DELTA));
+}
+
+void AudioOutput::wait() {
+    while (SDL_GetQueuedAudioSize(device) > target_bytes) {
+        SDL_Delay(1);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <SDL.h>
+
+class APU;
+
+// Streams APU output to an SDL audio device and uses the device as the
+// emulator's clock: the main loop blocks in wait() until the queue drains
+// below the target, and the resample ratio is nudged every frame so the
+// queue hovers around half-full instead of slowly over/underflowing because
+// the host's audio clock never exactly matches 59.73 Hz video.
+class AudioOutput {
+ public:
+    AudioOutput();
+    bool open(APU& apu, int sample_rate);
+    void close();
+    void push(APU& apu);
+    void wait();
+
+    bool is_open;
+    int underruns;
+
+ private:
+    SDL_AudioDeviceID device;
+    int sample_rate;
+    uint32_t target_bytes;
+    bool started;
+    std::vector<int16_t> samples;
+};
@@ -0,0 +1,99 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <array>
+
+#include "blip_buffer.h"
+
+// deltas are stored with this many fractional bits so the kernel taps don't lose precision
+const int DELTA_BITS = 15;
+// the integrator slowly leaks towards zero, which removes DC offset like the real hardware's capacitor
+const int BASS_SHIFT = 9;
+const double CUTOFF = 0.90;
+
+BlipBuffer::BlipBuffer(int capacity_samples) {
+    factor = 0;
+    offset = 0;
+    integrator = 0;
+    buf.resize(capacity_samples + WIDTH, 0);
+    kernel.resize(PHASES * WIDTH);
+
+    // precompute a windowed sinc impulse for every sub-sample phase, each normalized so its
+    // taps sum to exactly one unit (otherwise rounding errors integrate into a DC drift)
+    for (int phase = 0; phase < PHASES; phase++) {
+        double frac = (double)phase / PHASES;
+        std::array<double, WIDTH> taps;
+        double total = 0;
+        for (int i = 0; i < WIDTH; i++) {
+            double x = i - (HALF_WIDTH - 1) - frac;
+            double sinc = x == 0 ? 1.0 : std::sin(M_PI * x * CUTOFF) / (M_PI * x * CUTOFF);
+            // blackman window over the kernel width
+            double w = (i + 1 - frac) / (WIDTH + 1);
+            double window = 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+            taps[i] = sinc * window;
+            total += taps[i];
+        }
+        int sum = 0;
+        for (int i = 0; i < WIDTH; i++) {
+            int tap = (int)std::lround(taps[i] / total * (1 << DELTA_BITS));
+            kernel.at(phase * WIDTH + i) = tap;
+            sum += tap;
+        }
+        kernel.at(phase * WIDTH + HALF_WIDTH - 1) += (1 << DELTA_BITS) - sum;
+    }
+}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+    factor = (uint64_t)std::llround(sample_rate / clock_rate * 4294967296.0);
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    integrator = 0;
+    std::fill(buf.begin(), buf.end(), 0);
+}
+
+void BlipBuffer::add_delta(uint32_t clock_time, int delta) {
+    uint64_t fixed = offset + clock_time * factor;
+    size_t index = fixed >> 32;
+    int phase = (fixed >> (32 - PHASE_BITS)) & (PHASES - 1);
+    if (index + WIDTH > buf.size()) {
+        // more samples than we have room for, the reader is not keeping up
+        return;
+    }
+    int32_t* out = &buf[index];
+    const int32_t* taps = &kernel[phase * WIDTH];
+    for (int i = 0; i < WIDTH; i++) {
+        out[i] += taps[i] * delta;
+    }
+}
+
+void BlipBuffer::end_frame(uint32_t clock_duration) {
+    offset += clock_duration * factor;
+    uint64_t limit = (uint64_t)(buf.size() - WIDTH) << 32;
+    if (offset > limit)
+        offset = limit;
+}
+
+int BlipBuffer::samples_avail() const {
+    return offset >> 32;
+}
+
+int BlipBuffer::read_samples(int16_t* out, int count, int stride) {
+    count = std::min(count, samples_avail());
+    int32_t sum = integrator;
+    for (int i = 0; i < count; i++) {
+        sum += buf[i];
+        int32_t s = sum >> DELTA_BITS;
+        out[i * stride] = (int16_t)std::clamp(s, -32768, 32767);
+        sum -= s << (DELTA_BITS - BASS_SHIFT);
+    }
+    integrator = sum;
+
+    // shift the unread samples (and the kernel tails hanging past them) to the front
+    int remaining = samples_avail() - count + WIDTH;
+    std::memmove(buf.data(), buf.data() + count, remaining * sizeof(int32_t));
+    std::fill(buf.begin() + remaining, buf.begin() + remaining + count, 0);
+    offset -= (uint64_t)count << 32;
+    return count;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Band-limited step synthesis buffer.
+//
+// Instead of sampling the APU every cycle, the channels report amplitude
+// *changes* (deltas) at the cycle they happen. Each delta is spread over a
+// few output samples with a windowed-sinc kernel, and reading integrates the
+// deltas back into a waveform. This is cheap (work is proportional to the
+// number of transitions, not the clock rate) and avoids the aliasing you get
+// from naive decimation of a 4 MHz square wave.
+class BlipBuffer {
+ public:
+    static const int PHASE_BITS = 5;
+    static const int PHASES = 1 << PHASE_BITS;
+    static const int HALF_WIDTH = 8;
+    static const int WIDTH = HALF_WIDTH * 2;
+
+    explicit BlipBuffer(int capacity_samples);
+
+    // sample_rate may be nudged every frame (dynamic rate control)
+    void set_rates(double clock_rate, double sample_rate);
+    void clear();
+
+    // clock_time is relative to the start of the current frame
+    void add_delta(uint32_t clock_time, int delta);
+    void end_frame(uint32_t clock_duration);
+
+    int samples_avail() const;
+    // writes up to count samples, stride lets two buffers fill an interleaved stereo stream
+    int read_samples(int16_t* out, int count, int stride);
+
+ private:
+    uint64_t factor;
+    uint64_t offset;
+    int32_t integrator;
+    std::vector<int32_t> buf;
+    std::vector<int32_t> kernel;
+};
@@ -1,9 +1,30 @@
+#include <algorithm>
 #include <format>
 #include <string>
 #include <fstream>
+#include <stdexcept>
 #include "cartridge.h"
+#include "hash.h"
+#include "state.h"
 
 Cartridge::Cartridge() {
+    // an empty cartridge until load(), so the MMU always has something to map
+    rom.assign(0x8000, 0xFF);
+    ram.assign(0x2000, 0);
+    mbc_type = 0;
+    rom_banks = 2;
+    ram_banks = 1;
+    has_rtc = false;
+    ram_enabled = true;
+    rom_bank_lo = 1;
+    rom_bank_hi = 0;
+    ram_bank = 0;
+    banking_mode = false;
+    rtc.fill(0);
+    rtc_latched.fill(0);
+    rtc_latch = 0xFF;
+    write_control = &Cartridge::write_mbc<0>;
+    update_banks();
 }
 
 // void Cartridge::load(std::string filepath) {
@@ -15,53 +36,196 @@ Cartridge::Cartridge() {
 // }
 void Cartridge::load(std::string filepath) {
     std::ifstream ifd(filepath, std::ios::binary | std::ios::ate);
+    if (!ifd)
+        throw std::runtime_error("could not open " + filepath);
     std::streamsize size = ifd.tellg();
     ifd.seekg(0, std::ios::beg);
     rom.resize(size);
     ifd.read((char *)rom.data(), size);
+    decode_cache.clear();
+    // whole 16 KiB banks and at least two of them, so every mapped bank is fully in bounds
+    if (rom.size() < 0x8000)
+        rom.resize(0x8000, 0xFF);
+    rom.resize((rom.size() + 0x3FFF) & ~0x3FFF, 0xFF);
+    rom_banks = rom.size() / 0x4000;
 
     int cartridge_type = rom.at(0x0147);
+    has_rtc = cartridge_type == 0x0F || cartridge_type == 0x10;
     switch (cartridge_type) {
         // these may not be complete list
     case 0x00: case 0x08: case 0x09:
         mbc_type = 0;
+        write_control = &Cartridge::write_mbc<0>;
         break;
     case 0x01: case 0x02: case 0x03:
         mbc_type = 1;
+        write_control = &Cartridge::write_mbc<1>;
         break;
     case 0x05: case 0x06:
         mbc_type = 2;
+        write_control = &Cartridge::write_mbc<2>;
         break;
     case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
         mbc_type = 3;
+        write_control = &Cartridge::write_mbc<3>;
         break;
     case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
         mbc_type = 5;
-        break;
-    case 0x20:
-        mbc_type = 6;
-        break;
-    case 0x22:
-        mbc_type = 6;
+        write_control = &Cartridge::write_mbc<5>;
         break;
     default:
-        std::runtime_error("Unrecognized cartridge type");
+        throw std::runtime_error(std::format("cartridge type {:#04x} is not supported", cartridge_type));
+    }
+
+    // cartridges without ram still get a bank, test roms write their results there
+    static const int RAM_SIZES[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+    int ram_code = rom.at(0x0149);
+    int ram_size = ram_code < 6 ? RAM_SIZES[ram_code] : 0;
+    ram.assign(std::max(ram_size, 0x2000), 0);
+    ram_banks = ram.size() / 0x2000;
+
+    // without a controller the ram (if any) is simply always there
+    ram_enabled = mbc_type == 0;
+    rom_bank_lo = 1;
+    rom_bank_hi = 0;
+    ram_bank = 0;
+    banking_mode = false;
+    update_banks();
+}
+
+template <int MBC>
+void Cartridge::write_mbc(int address, uint8_t val) {
+    if constexpr (MBC == 0) {
+        // no controller, writes to rom do nothing
+    } else if constexpr (MBC == 1) {
+        if (address < 0x2000) {
+            ram_enabled = (val & 0x0F) == 0x0A;
+        } else if (address < 0x4000) {
+            rom_bank_lo = val & 0x1F;
+            if (rom_bank_lo == 0)
+                rom_bank_lo = 1;
+        } else if (address < 0x6000) {
+            rom_bank_hi = val & 0x03;
+        } else {
+            banking_mode = val & 1;
+        }
+    } else if constexpr (MBC == 2) {
+        // bit 8 of the address picks between ram enable and rom bank
+        if (address < 0x4000) {
+            if (address & 0x100) {
+                rom_bank_lo = val & 0x0F;
+                if (rom_bank_lo == 0)
+                    rom_bank_lo = 1;
+            } else {
+                ram_enabled = (val & 0x0F) == 0x0A;
+            }
+        }
+    } else if constexpr (MBC == 3) {
+        if (address < 0x2000) {
+            ram_enabled = (val & 0x0F) == 0x0A;
+        } else if (address < 0x4000) {
+            rom_bank_lo = val & 0x7F;
+            if (rom_bank_lo == 0)
+                rom_bank_lo = 1;
+        } else if (address < 0x6000) {
+            ram_bank = val & 0x0F;
+        } else {
+            // writing 0 then 1 copies the clock into the readable registers
+            if (rtc_latch == 0 && val == 1)
+                rtc_latched = rtc;
+            rtc_latch = val;
+        }
+    } else if constexpr (MBC == 5) {
+        if (address < 0x2000) {
+            ram_enabled = (val & 0x0F) == 0x0A;
+        } else if (address < 0x3000) {
+            rom_bank_lo = val;
+        } else if (address < 0x4000) {
+            rom_bank_hi = val & 1;
+        } else if (address < 0x6000) {
+            ram_bank = val & 0x0F;
+        }
     }
 }
 
-uint8_t Cartridge::read(int address) {
-    // TODO: || true makes certain blargg tests pass, but this should be removed
-    if (mbc_type == 0 || true) {
-        return rom.at(address);
-    } else {
-        throw std::runtime_error(std::format("mbc type {} is not implemented yet", mbc_type));
+void Cartridge::update_banks() {
+    int bank0 = 0;
+    int bankx = rom_bank_lo;
+    int ram_index = ram_bank;
+    if (mbc_type == 1) {
+        // the two upper bits extend the rom bank, in mode 1 they also bank 0x0000 and the ram
+        bankx |= rom_bank_hi << 5;
+        if (banking_mode)
+            bank0 = rom_bank_hi << 5;
+        ram_index = banking_mode ? rom_bank_hi : 0;
+    } else if (mbc_type == 5) {
+        bankx |= rom_bank_hi << 8;
     }
+    rom0 = &rom[(bank0 % rom_banks) * 0x4000];
+    romx = &rom[(bankx % rom_banks) * 0x4000];
+    const Instruction* decoded = decode_cache.entries();
+    decoded0 = decoded ? decoded + (rom0 - rom.data()) : nullptr;
+    decodedx = decoded ? decoded + (romx - rom.data()) : nullptr;
+
+    bool plain_ram = ram_enabled && mbc_type != 2 && !(mbc_type == 3 && ram_index >= 0x08);
+    ram_page = plain_ram ? &ram[(ram_index % ram_banks) * 0x2000] : nullptr;
 }
 
-void Cartridge::write(int address, uint8_t val) {
-    if (mbc_type == 0) {
-        rom.at(address) = val;
-    } else {
-        throw std::runtime_error(std::format("mbc type {} is not implemented yet", mbc_type));
+uint8_t Cartridge::read_ram(int address) {
+    if (!ram_enabled)
+        return 0xFF;
+    if (mbc_type == 2) {
+        // 512 half-bytes, mirrored over the whole area
+        return ram[(address - 0xA000) & 0x1FF] | 0xF0;
     }
+    if (mbc_type == 3 && has_rtc && ram_bank >= 0x08 && ram_bank <= 0x0C)
+        return rtc_latched[ram_bank - 0x08];
+    return 0xFF;
+}
+
+void Cartridge::write_ram(int address, uint8_t val) {
+    if (!ram_enabled)
+        return;
+    if (mbc_type == 2)
+        ram[(address - 0xA000) & 0x1FF] = val & 0x0F;
+    else if (mbc_type == 3 && has_rtc && ram_bank >= 0x08 && ram_bank <= 0x0C)
+        rtc[ram_bank - 0x08] = val;
+}
+
+void Cartridge::load_decode_cache(const std::string& dir) {
+    decode_cache.load(rom, rom_hash(), dir);
+    update_banks();
+}
+
+int Cartridge::rom_bank() {
+    return (romx - rom.data()) / 0x4000;
+}
+
+uint64_t Cartridge::rom_hash() {
+    return hash64(rom.data(), rom.size());
+}
+
+void Cartridge::save_state(StateWriter& state) {
+    state.write_bytes(ram);
+    state.write(ram_enabled);
+    state.write(rom_bank_lo);
+    state.write(rom_bank_hi);
+    state.write(ram_bank);
+    state.write(banking_mode);
+    state.write(rtc);
+    state.write(rtc_latched);
+    state.write(rtc_latch);
+}
+
+void Cartridge::load_state(StateReader& state) {
+    state.read_bytes(ram);
+    state.read(ram_enabled);
+    state.read(rom_bank_lo);
+    state.read(rom_bank_hi);
+    state.read(ram_bank);
+    state.read(banking_mode);
+    state.read(rtc);
+    state.read(rtc_latched);
+    state.read(rtc_latch);
+    update_banks();
 }
@@ -1,12 +1,81 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
 #include <vector>
 
+#include "decode_cache.h"
+
+class StateWriter;
+class StateReader;
+
+// Cartridge rom, external ram and the memory bank controller.
+//
+// Reads never go through here on the hot path: the MMU's page table points
+// straight at the currently mapped rom/ram banks (rom0, romx, ram_page below)
+// and is rebuilt after every write to the controller. The controller itself is
+// a template instantiated per MBC type, picked once in load(), so no access
+// ever branches on the cartridge type.
 class Cartridge {
  private:
     std::vector<uint8_t> rom;
+    std::vector<uint8_t> ram;
     int mbc_type;
+    int rom_banks;
+    int ram_banks;
+    bool has_rtc;
+
+    // controller registers
+    bool ram_enabled;
+    int rom_bank_lo;
+    int rom_bank_hi;
+    int ram_bank;
+    bool banking_mode;
+
+    // MBC3 clock registers (08-0C), the clock does not run yet but games can latch and set it
+    std::array<uint8_t, 5> rtc;
+    std::array<uint8_t, 5> rtc_latched;
+    uint8_t rtc_latch;
+
+    DecodeCache decode_cache;
+
+    void (Cartridge::*write_control)(int address, uint8_t val);
+    template <int MBC>
+    void write_mbc(int address, uint8_t val);
+    void update_banks();
+
  public:
     Cartridge();
     void load(std::string filepath);
-    uint8_t read(int address);
-    void write(int address, uint8_t val);
+    // decodes the rom's code ahead of time (or maps it from dir, see DecodeCache)
+    void load_decode_cache(const std::string& dir);
+    const DecodeCache& decoded() const { return decode_cache; }
+
+    // currently mapped memory, what the MMU's page table points at. ram_page is
+    // null when reads and writes need read_ram/write_ram (disabled, MBC2, clock)
+    const uint8_t* rom0;
+    const uint8_t* romx;
+    uint8_t* ram_page;
+    // the decoded instructions of rom0/romx, null without a decode cache
+    const Instruction* decoded0;
+    const Instruction* decodedx;
+
+    uint8_t read(int address) {
+        return address < 0x4000 ? rom0[address] : romx[address - 0x4000];
+    }
+    // 0x0000-0x7FFF, bank switching
+    void write(int address, uint8_t val) {
+        (this->*write_control)(address, val);
+        update_banks();
+    }
+    // 0xA000-0xBFFF when ram_page is null
+    uint8_t read_ram(int address);
+    void write_ram(int address, uint8_t val);
+
+    int rom_bank();
+    uint64_t rom_hash();
+
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
 };
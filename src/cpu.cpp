@@ -1,10 +1,14 @@
 #include <array>
+#include <bit>
 #include <string>
 #include <vector>
 #include <iostream>
 
 #include "gameboy-emu.h"
 #include "cpu.h"
+#include "cartridge.h"
+#include "instruction.h"
+#include "state.h"
 
 #include <chrono>
 #include <thread>
@@ -15,97 +19,71 @@
 // - implement TODOs
 // - check the carry arithmetic formulas
 
-const std::array<int, 256> instruction_length = {
-    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
-    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
-    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,
-    2, 1, 2, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1,
-    2, 1, 2, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1,
-};
-
 CPU::CPU() {
     IME = false;
     set_IME_delay = 0;
+    halted = false;
+    halt_bug = false;
+    ld_b_b_executed = false;
+}
+
+// IF/IE bits in priority order (the lowest set bit wins), handler at 0x40 + 8 * bit:
+// vblank, lcd stat, timer, serial, joypad
+const std::array<uint8_t, 32> interrupt_priority = [] {
+    std::array<uint8_t, 32> table{};
+    for (int flags = 1; flags < 32; flags++)
+        table[flags] = std::countr_zero((unsigned)flags);
+    return table;
+}();
+
+int CPU::handle_interrupts() {
+    uint8_t pending = gameboy->mmu.interrupts_pending();
+    if (!pending)
+        return 0;
+
+    // anything pending ends HALT, even with IME off (the cpu just carries on after the halt)
+    halted = false;
+    if (!IME)
+        return 0;
+
+    int bit = interrupt_priority[pending];
+    gameboy->mmu.acknowledge_interrupt(1 << bit);
+    IME = false;
+    registers.SP -= 2;
+    write_mmu_16(registers.SP, registers.PC);
+    registers.PC = 0x40 + 8 * bit;
+    return 20;
 }
 
-int IE_ADDRESS = 0xFFFF;
-int IF_ADDRESS = 0xFF0F;
-int VBLANK_BIT = 0b1;
-int LCD_BIT = 0b01;
-int TIMER_BIT = 0b001;
-int SERIAL_BIT = 0b0001;
-int JOYPAD_BIT = 0b00001;
-
-void CPU::handle_interrupts() {
-    if (IME) {
-        int IE = gameboy->read_mmu(IE_ADDRESS);
-        int IF = gameboy->read_mmu(IF_ADDRESS);
-
-        int flags = IE & IF;
-
-        if (flags & VBLANK_BIT) {
-            gameboy->write_mmu(IF_ADDRESS, IF ^ VBLANK_BIT);
-            IME = false;
-            registers.SP -= 2;
-            write_mmu_16(registers.SP, registers.PC);
-            registers.PC = 0x40;
-            return;
-        } else if (flags & LCD_BIT) {
-            gameboy->write_mmu(IF_ADDRESS, IF ^ LCD_BIT);
-            IME = false;
-            registers.SP -= 2;
-            write_mmu_16(registers.SP, registers.PC);
-            registers.PC = 0x48;
-            return;
-        } else if (flags & TIMER_BIT) {
-            gameboy->write_mmu(IF_ADDRESS, IF ^ TIMER_BIT);
-            IME = false;
-            registers.SP -= 2;
-            write_mmu_16(registers.SP, registers.PC);
-            registers.PC = 0x50;
-            return;
-        } else if (flags & SERIAL_BIT) {
-            gameboy->write_mmu(IF_ADDRESS, IF ^ SERIAL_BIT);
-            IME = false;
-            registers.SP -= 2;
-            write_mmu_16(registers.SP, registers.PC);
-            registers.PC = 0x58;
-            return;
-        } else if (flags & JOYPAD_BIT) {
-            gameboy->write_mmu(IF_ADDRESS, IF ^ JOYPAD_BIT);
-            IME = false;
-            registers.SP -= 2;
-            write_mmu_16(registers.SP, registers.PC);
-            registers.PC = 0x60;
-            return;
-        }
-    }
-}
 
+Instruction CPU::fetch() {
+    if (halt_bug) [[unlikely]]
+        return fetch_after_halt_bug();
+#ifndef GB_MEMSTATS
+    // rom code decoded ahead of time (memstats wants to see every read, so not there)
+    const Instruction* decoded = gameboy->mmu.decoded(registers.PC);
+    if (decoded && decoded->length)
+        return *decoded;
+#endif
+    uint8_t bytes[3];
+    bytes[0] = gameboy->read_mmu(registers.PC);
+    int length = instruction_length[bytes[0]];
+    for (int i = 1; i < length; i++)
+        bytes[i] = gameboy->read_mmu((registers.PC + i) & 0xFFFF);
+    return decode_instruction(bytes);
+}
 
-std::vector<uint8_t> CPU::fetch() {
-    auto opcode = gameboy->read_mmu(this->registers.PC);
-    int num_bytes;
-    if (opcode == 0xCB)
-        num_bytes = 2;
-    else
-        num_bytes = instruction_length.at(opcode);
-    std::vector<uint8_t> instruction(num_bytes);
-    for (int i = 0; i < num_bytes; i++) {
-        instruction.at(i) = gameboy->read_mmu(this->registers.PC+i);
-    }
-    return instruction;
+Instruction CPU::fetch_after_halt_bug() {
+    // PC isn't incremented after the opcode, so the opcode is also the first operand
+    // byte and the instruction ends one byte early: halt; ld a,$14 runs ld a,$3E; inc d
+    halt_bug = false;
+    uint8_t bytes[3];
+    bytes[0] = gameboy->read_mmu(registers.PC);
+    int length = instruction_length[bytes[0]];
+    for (int i = 1; i < length; i++)
+        bytes[i] = gameboy->read_mmu((registers.PC + i - 1) & 0xFFFF);
+    registers.PC -= 1;
+    return decode_instruction(bytes);
 }
 
 
@@ -442,8 +420,14 @@ int CPU::ld_r8_r8(r8ptr_t aptr, r8ptr_t bptr) {
 }
 
 int CPU::halt() {
-    throw std::runtime_error("this has not been implemented yet");
-    return -1;
+    registers.PC += 1;
+    // with an interrupt already pending there is nothing to wait for, and with IME off
+    // (and no EI about to turn it on) that is the halt bug
+    if (!gameboy->mmu.interrupts_pending())
+        halted = true;
+    else if (!IME && set_IME_delay == 0)
+        halt_bug = true;
+    return 4;
 }
 
 int CPU::add_a_r8(r8ptr_t r8ptr) {
@@ -846,8 +830,8 @@ int CPU::set_b3_r8(int b3, r8ptr_t r8ptr) {
 }
 
 
-int CPU::execute_CB(std::vector<uint8_t> instr) {
-    uint8_t opcode = instr.at(1);
+int CPU::execute_CB(const Instruction& instr) {
+    uint8_t opcode = instr.imm8();
 
     int cycles;
     if ((opcode & 0b11111000) == 0b00000000) {
@@ -970,6 +954,22 @@ void CPU::print_state() {
 
 }
 
+void CPU::save_state(StateWriter& state) {
+    state.write(registers);
+    state.write(IME);
+    state.write(set_IME_delay);
+    state.write(halted);
+    state.write(halt_bug);
+}
+
+void CPU::load_state(StateReader& state) {
+    state.read(registers);
+    state.read(IME);
+    state.read(set_IME_delay);
+    state.read(halted);
+    state.read(halt_bug);
+}
+
 void CPU::init(bool skip_boot_rom) {
     if (skip_boot_rom) {
         registers.AF = 0x01B0;
@@ -988,8 +988,11 @@ void CPU::init(bool skip_boot_rom) {
     }
 }
 
-int CPU::execute(std::vector<uint8_t> instr) {
-    uint8_t opcode = instr.at(0);
+int CPU::execute(const Instruction& instr) {
+    uint8_t opcode = instr.opcode;
+#ifdef GB_PROFILE
+    uint16_t profile_pc = registers.PC;
+#endif
 
     int cycles;
 
@@ -1000,13 +1003,13 @@ int CPU::execute(std::vector<uint8_t> instr) {
     }
 
     else if ((opcode & 0b11001111) == 0b00000001) {
-        cycles = ld_r16_imm16(get_r16(opcode >> 4), *(uint16_t*)&instr.at(1));
+        cycles = ld_r16_imm16(get_r16(opcode >> 4), instr.imm16());
     } else if ((opcode & 0b11001111) == 0b00000010) {
         cycles = ld_r16mem_a(get_r16mem(opcode >> 4));
     } else if ((opcode & 0b11001111) == 0b00001010) {
         cycles = ld_a_r16mem(get_r16mem(opcode >> 4));
     } else if (opcode == 0b00001000) {
-        cycles = ld_imm16_sp(*(uint16_t*)&instr.at(1));
+        cycles = ld_imm16_sp(instr.imm16());
     }
 
     else if ((opcode & 0b11001111) == 0b00000011) {
@@ -1024,7 +1027,7 @@ int CPU::execute(std::vector<uint8_t> instr) {
     }
 
     else if ((opcode & 0b11000111) == 0b00000110) {
-        cycles = ld_r8_imm8(get_r8(opcode >> 3), instr.at(1));
+        cycles = ld_r8_imm8(get_r8(opcode >> 3), instr.imm8());
     }
 
     else if (opcode == 0b00000111) {
@@ -1046,9 +1049,9 @@ int CPU::execute(std::vector<uint8_t> instr) {
     }
 
     else if (opcode == 0b00011000) {
-        cycles = jr_imm8(instr.at(1));
+        cycles = jr_imm8(instr.imm8());
     } else if ((opcode & 0b11100111) == 0b00100000) {
-        cycles = jr_cond_imm8(get_cond((opcode >> 3) & 0b11), instr.at(1));
+        cycles = jr_cond_imm8(get_cond((opcode >> 3) & 0b11), instr.imm8());
     }
 
     else if (opcode == 0b00010000) {
@@ -1057,14 +1060,18 @@ int CPU::execute(std::vector<uint8_t> instr) {
 
     // BLOCK 1
 
-    else if ((opcode & 0b11000000) == 0b01000000) {
-        cycles = ld_r8_r8(get_r8((opcode >> 3) & 0b111), get_r8(opcode & 0b111));
-    }
-
+    // halt sits where ld [hl],[hl] would be, so it has to be matched first
     else if (opcode == 0b01110110) {
         cycles = halt();
     }
 
+    else if ((opcode & 0b11000000) == 0b01000000) {
+        // ld b,b does nothing, test roms (mooneye) use it as a software breakpoint
+        if (opcode == 0b01000000)
+            ld_b_b_executed = true;
+        cycles = ld_r8_r8(get_r8((opcode >> 3) & 0b111), get_r8(opcode & 0b111));
+    }
+
     // BLOCK 2
 
     else if ((opcode & 0b11111000) == 0b10000000) {
@@ -1088,21 +1095,21 @@ int CPU::execute(std::vector<uint8_t> instr) {
     // BLOCK 3
 
     else if (opcode == 0b11000110) {
-        cycles = add_a_imm8(instr.at(1));
+        cycles = add_a_imm8(instr.imm8());
     } else if (opcode == 0b11001110) {
-        cycles = adc_a_imm8(instr.at(1));
+        cycles = adc_a_imm8(instr.imm8());
     } else if (opcode == 0b11010110) {
-        cycles = sub_a_imm8(instr.at(1));
+        cycles = sub_a_imm8(instr.imm8());
     } else if (opcode == 0b11011110) {
-        cycles = sbc_a_imm8(instr.at(1));
+        cycles = sbc_a_imm8(instr.imm8());
     } else if (opcode == 0b11100110) {
-        cycles = and_a_imm8(instr.at(1));
+        cycles = and_a_imm8(instr.imm8());
     } else if (opcode == 0b11101110) {
-        cycles = xor_a_imm8(instr.at(1));
+        cycles = xor_a_imm8(instr.imm8());
     } else if (opcode == 0b11110110) {
-        cycles = or_a_imm8(instr.at(1));
+        cycles = or_a_imm8(instr.imm8());
     } else if (opcode == 0b11111110) {
-        cycles = cp_a_imm8(instr.at(1));
+        cycles = cp_a_imm8(instr.imm8());
     }
 
     else if ((opcode & 0b11100111) == 0b11000000) {
@@ -1112,15 +1119,15 @@ int CPU::execute(std::vector<uint8_t> instr) {
     } else if (opcode == 0b11011001) {
         cycles = reti();
     } else if ((opcode & 0b11100111) == 0b11000010) {
-        cycles = jp_cond_imm16(get_cond((opcode >> 3) & 0b11), *(uint16_t*)&instr.at(1));
+        cycles = jp_cond_imm16(get_cond((opcode >> 3) & 0b11), instr.imm16());
     } else if (opcode == 0b11000011) {
-        cycles = jp_imm16(*(uint16_t*)&instr.at(1));
+        cycles = jp_imm16(instr.imm16());
     } else if (opcode == 0b11101001) {
         cycles = jp_hl();
     } else if ((opcode & 0b11100111) == 0b11000100) {
-        cycles = call_cond_imm16(get_cond((opcode >> 3) & 0b11), *(uint16_t*)&instr.at(1));
+        cycles = call_cond_imm16(get_cond((opcode >> 3) & 0b11), instr.imm16());
     } else if (opcode == 0b11001101) {
-        cycles = call_imm16(*(uint16_t*)&instr.at(1));
+        cycles = call_imm16(instr.imm16());
     } else if ((opcode & 0b11000111) == 0b11000111) {
         cycles = rst_tgt3((opcode >> 3) & 0b111);
     }
@@ -1138,21 +1145,21 @@ int CPU::execute(std::vector<uint8_t> instr) {
     else if (opcode == 0b11100010) {
         cycles = ldh_cmem_a();
     } else if (opcode == 0b11100000) {
-        cycles = ldh_imm8_a(instr.at(1));
+        cycles = ldh_imm8_a(instr.imm8());
     } else if (opcode == 0b11101010) {
-        cycles = ld_imm16_a(*(uint16_t*)&instr.at(1));
+        cycles = ld_imm16_a(instr.imm16());
     } else if (opcode == 0b11110010) {
         cycles = ldh_a_cmem();
     } else if (opcode == 0b11110000) {
-        cycles = ldh_a_imm8(instr.at(1));
+        cycles = ldh_a_imm8(instr.imm8());
     } else if (opcode == 0b11111010) {
-        cycles = ld_a_imm16(*(uint16_t*)&instr.at(1));
+        cycles = ld_a_imm16(instr.imm16());
     }
 
     else if (opcode == 0b11101000) {
-        cycles = add_sp_imm8(instr.at(1));
+        cycles = add_sp_imm8(instr.imm8());
     } else if (opcode == 0b11111000) {
-        cycles = ld_hl_sppimm8(instr.at(1));
+        cycles = ld_hl_sppimm8(instr.imm8());
     } else if (opcode == 0b11111001) {
         cycles = ld_sp_hl();
     }
@@ -1176,5 +1183,12 @@ int CPU::execute(std::vector<uint8_t> instr) {
         }
     }
 
+#ifdef GB_PROFILE
+    int bank = 0;
+    if (profile_pc >= 0x4000 && profile_pc < 0x8000)
+        bank = gameboy->cartridge.rom_bank();
+    profiler.record(opcode, opcode == 0xCB ? instr.imm8() : 0, cycles, bank, profile_pc);
+#endif
+
     return cycles;
 }
@@ -1,7 +1,16 @@
+#pragma once
+
+#include <cstdint>
 #include <functional>
 #include <vector>
 #include <array>
 
+#include "instruction.h"
+
+#ifdef GB_PROFILE
+#include "profiler.h"
+#endif
+
 struct Registers {
     // TODO: can this be cleaned up to use bit flags for the F register?
     union {
@@ -91,22 +100,33 @@ struct r8ptr_t {
 };
 
 class Gameboy;
+class StateWriter;
+class StateReader;
 class CPU {
  public:
     Gameboy* gameboy;
     Registers registers;
+    bool ld_b_b_executed;
+    // waiting in HALT for an interrupt, run_frame skips ahead instead of fetching
+    bool halted;
 
     CPU();
-    std::vector<uint8_t> fetch();
-    int execute(std::vector<uint8_t> instr);
+    Instruction fetch();
+    int execute(const Instruction& instr);
     void init(bool skip_boot_rom);
     void print_state();
-    void handle_interrupts();
+    // jumps to the highest priority pending interrupt if IME allows, returns the cycles that took
+    int handle_interrupts();
 
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
 
  private:
     bool IME;
     int set_IME_delay;
+    // HALT with IME off and an interrupt pending doesn't halt, and the byte after it is read twice
+    bool halt_bug;
+    Instruction fetch_after_halt_bug();
 
     void write_mmu_16(int address, uint16_t val);
     uint16_t read_mmu_16(int address);
@@ -174,7 +194,7 @@ class CPU {
     int pop_r16stk(uint16_t* r16);
     int push_r16stk(uint16_t* r16);
 
-    int execute_CB(std::vector<uint8_t> instr);
+    int execute_CB(const Instruction& instr);
 
     int rlc_r8(r8ptr_t r8ptr);
     int rrc_r8(r8ptr_t r8ptr);
@@ -203,4 +223,10 @@ class CPU {
 
     int di();
     int ei();
+
+ public:
+    // last, it's big and cold
+#ifdef GB_PROFILE
+    Profiler profiler;
+#endif
 };
@@ -0,0 +1,344 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gameboy-emu.h"
+#include "debugger.h"
+
+static bool parse_hex(std::string text, uint16_t& value) {
+    if (text.starts_with("0x") || text.starts_with("0X"))
+        text = text.substr(2);
+    else if (text.starts_with("$"))
+        text = text.substr(1);
+    if (text.empty() || text.size() > 4 || text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return false;
+    value = std::stoul(text, nullptr, 16);
+    return true;
+}
+
+static bool is_register(const std::string& name) {
+    for (const char* known : {"a", "f", "b", "c", "d", "e", "h", "l", "af", "bc", "de", "hl", "sp", "pc"}) {
+        if (name == known)
+            return true;
+    }
+    return false;
+}
+
+static bool is_comparison(const std::string& op) {
+    return op == "==" || op == "!=" || op == "<" || op == "<=" || op == ">" || op == ">=";
+}
+
+Debugger::Debugger() : gameboy(nullptr), pc_breaks(0x10000, 0), next_id(1), stop_pending(false),
+                       is_stopped(false), steps(0), resume_pc(-1), peeking(false), muted(false) {
+}
+
+void Debugger::request_stop(const std::string& why) {
+    stop_pending = true;
+    stop_reason = why;
+}
+
+bool Debugger::before_instruction() {
+    if (muted)
+        return false;
+    int pc = gameboy->cpu.registers.PC;
+    bool resuming = pc == resume_pc;
+    resume_pc = -1;
+
+    if (steps > 0 && --steps == 0)
+        request_stop("step");
+    if (pc_breaks[pc] && !resuming) {
+        for (Breakpoint& breakpoint : breakpoints) {
+            if (breakpoint.pc != pc || !condition_holds(breakpoint.condition))
+                continue;
+            breakpoint.hits++;
+            char text[64];
+            snprintf(text, sizeof(text), "breakpoint %d at %04X", breakpoint.id, pc);
+            request_stop(text);
+            break;
+        }
+    }
+    if (!stop_pending)
+        return false;
+    stop_pending = false;
+    is_stopped = true;
+    // a step cut short by a breakpoint doesn't carry on after continuing
+    steps = 0;
+    return true;
+}
+
+void Debugger::watch_hit(int address, uint8_t value, bool write) {
+    if (peeking || muted)
+        return;
+    for (Watchpoint& watch : watchpoints) {
+        if (address < watch.first || address > watch.last || !(write ? watch.write : watch.read))
+            continue;
+        watch.hits++;
+        if (watch.action == Action::count)
+            continue;
+        // the cpu has already moved PC past the opcode, close enough to find the instruction
+        char text[96];
+        snprintf(text, sizeof(text), "watchpoint %d: %s %04X %s %02X near PC %04X", watch.id,
+                 write ? "write" : "read", address, write ? "<-" : "->", value, gameboy->cpu.registers.PC);
+        if (watch.action == Action::log)
+            fprintf(stderr, "%s\n", text);
+        else
+            request_stop(text);
+    }
+}
+
+void Debugger::console() {
+    fprintf(stderr, "%s\n", stop_reason.c_str());
+    print_registers();
+    std::string line;
+    while (true) {
+        fprintf(stderr, "(gb) ");
+        fflush(stderr);
+        if (!std::getline(std::cin, line)) {
+            // nobody to ask, so nothing may stop again
+            fprintf(stderr, "\nstdin closed, removing breakpoints and stopping watchpoints\n");
+            breakpoints.clear();
+            pc_breaks.assign(0x10000, 0);
+            std::erase_if(watchpoints, [](const Watchpoint& watch) { return watch.action == Action::stop; });
+            update_watched_pages();
+            steps = 0;
+            break;
+        }
+        std::istringstream words(line);
+        std::string name;
+        if (!(words >> name))
+            continue;
+        if (name == "c")
+            break;
+        if (name == "s") {
+            long count = 1;
+            std::string text;
+            if (words >> text) {
+                try {
+                    count = std::stol(text);
+                } catch (const std::exception&) {
+                    count = 0;
+                }
+            }
+            if (count < 1) {
+                fprintf(stderr, "s needs a positive count\n");
+                continue;
+            }
+            steps = count + 1;
+            break;
+        }
+        if (name == "q")
+            std::exit(0);
+        command(line);
+    }
+    is_stopped = false;
+    resume_pc = gameboy->cpu.registers.PC;
+}
+
+bool Debugger::command(const std::string& line) {
+    std::istringstream words(line);
+    std::string name;
+    words >> name;
+    std::vector<std::string> args;
+    for (std::string word; words >> word;)
+        args.push_back(word);
+
+    if (name == "r") {
+        print_registers();
+        return true;
+    }
+    if (name == "l") {
+        print_list();
+        return true;
+    }
+
+    if (name == "b") {
+        Breakpoint breakpoint = {next_id, 0, {"", 0, "", 0}, 0};
+        bool ok = args.size() == 1 || args.size() == 5;
+        ok = ok && parse_hex(args[0], breakpoint.pc);
+        if (ok && args.size() == 5) {
+            Condition& condition = breakpoint.condition;
+            const std::string& lhs = args[2];
+            if (lhs.size() > 2 && lhs.front() == '[' && lhs.back() == ']')
+                ok = parse_hex(lhs.substr(1, lhs.size() - 2), condition.address);
+            else
+                ok = is_register(lhs);
+            condition.lhs = lhs;
+            condition.op = args[3];
+            ok = ok && args[1] == "if" && is_comparison(condition.op) && parse_hex(args[4], condition.value);
+        }
+        if (!ok) {
+            fprintf(stderr, "usage: b ADDR [if REG|[ADDR] OP VALUE]\n");
+            return false;
+        }
+        breakpoints.push_back(breakpoint);
+        pc_breaks[breakpoint.pc]++;
+        fprintf(stderr, "breakpoint %d at %04X\n", next_id++, breakpoint.pc);
+        return true;
+    }
+
+    if (name == "w") {
+        Watchpoint watch = {next_id, 0, 0, true, true, Action::stop, 0};
+        bool ok = !args.empty();
+        if (ok) {
+            size_t dash = args[0].find('-');
+            ok = parse_hex(args[0].substr(0, dash), watch.first);
+            watch.last = watch.first;
+            if (ok && dash != std::string::npos)
+                ok = parse_hex(args[0].substr(dash + 1), watch.last) && watch.last >= watch.first;
+        }
+        for (size_t i = 1; ok && i < args.size(); i++) {
+            if (args[i] == "r" || args[i] == "w" || args[i] == "rw") {
+                watch.read = args[i] != "w";
+                watch.write = args[i] != "r";
+            } else if (args[i] == "log") {
+                watch.action = Action::log;
+            } else if (args[i] == "count") {
+                watch.action = Action::count;
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "usage: w FIRST[-LAST] [r|w|rw] [log|count]\n");
+            return false;
+        }
+        watchpoints.push_back(watch);
+        update_watched_pages();
+        fprintf(stderr, "watchpoint %d at %04X-%04X\n", next_id++, watch.first, watch.last);
+        return true;
+    }
+
+    if (name == "d") {
+        int id = args.size() == 1 ? std::atoi(args[0].c_str()) : 0;
+        for (size_t i = 0; i < breakpoints.size(); i++) {
+            if (breakpoints[i].id == id) {
+                pc_breaks[breakpoints[i].pc]--;
+                breakpoints.erase(breakpoints.begin() + i);
+                return true;
+            }
+        }
+        for (size_t i = 0; i < watchpoints.size(); i++) {
+            if (watchpoints[i].id == id) {
+                watchpoints.erase(watchpoints.begin() + i);
+                update_watched_pages();
+                return true;
+            }
+        }
+        fprintf(stderr, "no breakpoint or watchpoint %s\n", args.empty() ? "given" : args[0].c_str());
+        return false;
+    }
+
+    if (name == "x") {
+        uint16_t address = 0;
+        int count = args.size() > 1 ? std::atoi(args[1].c_str()) : 16;
+        if (args.empty() || !parse_hex(args[0], address) || count < 1) {
+            fprintf(stderr, "usage: x ADDR [N]\n");
+            return false;
+        }
+        for (int i = 0; i < count; i++) {
+            int at = (address + i) & 0xFFFF;
+            if (i % 16 == 0)
+                fprintf(stderr, "%s%04X:", i ? "\n" : "", at);
+            fprintf(stderr, " %02X", peek(at));
+        }
+        fprintf(stderr, "\n");
+        return true;
+    }
+
+    fprintf(stderr, "unknown command %s (c s r b w l d x q)\n", name.c_str());
+    return false;
+}
+
+uint8_t Debugger::peek(int address) {
+    peeking = true;
+    uint8_t value;
+    try {
+        value = gameboy->read_mmu(address);
+    } catch (const std::exception&) {
+        // echo ram throws on purpose
+        value = 0xFF;
+    }
+    peeking = false;
+    return value;
+}
+
+bool Debugger::condition_holds(const Condition& condition) {
+    if (condition.lhs.empty())
+        return true;
+    const Registers& r = gameboy->cpu.registers;
+    const std::string& lhs = condition.lhs;
+    int value;
+    if (lhs.front() == '[')
+        value = peek(condition.address);
+    else if (lhs == "a") value = r.A;
+    else if (lhs == "f") value = r.F;
+    else if (lhs == "b") value = r.B;
+    else if (lhs == "c") value = r.C;
+    else if (lhs == "d") value = r.D;
+    else if (lhs == "e") value = r.E;
+    else if (lhs == "h") value = r.H;
+    else if (lhs == "l") value = r.L;
+    else if (lhs == "af") value = r.AF;
+    else if (lhs == "bc") value = r.BC;
+    else if (lhs == "de") value = r.DE;
+    else if (lhs == "hl") value = r.HL;
+    else if (lhs == "sp") value = r.SP;
+    else value = r.PC;
+
+    const std::string& op = condition.op;
+    if (op == "==") return value == condition.value;
+    if (op == "!=") return value != condition.value;
+    if (op == "<") return value < condition.value;
+    if (op == "<=") return value <= condition.value;
+    if (op == ">") return value > condition.value;
+    return value >= condition.value;
+}
+
+void Debugger::update_watched_pages() {
+    std::array<uint8_t, 256> pages{};
+    for (const Watchpoint& watch : watchpoints) {
+        for (int page = watch.first >> 8; page <= watch.last >> 8; page++)
+            pages[page] |= (watch.read ? WATCH_READ : 0) | (watch.write ? WATCH_WRITE : 0);
+    }
+    gameboy->mmu.set_watched(pages);
+}
+
+void Debugger::print_registers() {
+    const Registers& r = gameboy->cpu.registers;
+    fprintf(stderr, "PC %04X  AF %04X  BC %04X  DE %04X  HL %04X  SP %04X  bank %02X  LY %02X%s  [%02X %02X %02X]\n",
+            r.PC, r.AF, r.BC, r.DE, r.HL, r.SP, gameboy->cartridge.rom_bank(), peek(0xFF44),
+            gameboy->cpu.halted ? "  halted" : "", peek(r.PC), peek((r.PC + 1) & 0xFFFF), peek((r.PC + 2) & 0xFFFF));
+}
+
+void Debugger::print_list() {
+    for (const Breakpoint& breakpoint : breakpoints) {
+        fprintf(stderr, "%d: break %04X", breakpoint.id, breakpoint.pc);
+        if (!breakpoint.condition.lhs.empty())
+            fprintf(stderr, " if %s %s %X", breakpoint.condition.lhs.c_str(), breakpoint.condition.op.c_str(),
+                    breakpoint.condition.value);
+        fprintf(stderr, ", %llu hits\n", (unsigned long long)breakpoint.hits);
+    }
+    for (const Watchpoint& watch : watchpoints) {
+        const char* action = watch.action == Action::log ? " log" : watch.action == Action::count ? " count" : "";
+        fprintf(stderr, "%d: watch %04X-%04X %s%s%s, %llu hits\n", watch.id, watch.first, watch.last,
+                watch.read ? "r" : "", watch.write ? "w" : "", action, (unsigned long long)watch.hits);
+    }
+}
+
+void Debugger::print_report(FILE* out) const {
+    for (const Breakpoint& breakpoint : breakpoints) {
+        if (breakpoint.hits)
+            fprintf(out, "breakpoint %d at %04X: %llu hits\n", breakpoint.id, breakpoint.pc,
+                    (unsigned long long)breakpoint.hits);
+    }
+    for (const Watchpoint& watch : watchpoints) {
+        if (watch.hits)
+            fprintf(out, "watchpoint %d at %04X-%04X: %llu hits\n", watch.id, watch.first, watch.last,
+                    (unsigned long long)watch.hits);
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Gameboy;
+
+// Breakpoints, conditional breakpoints and read/write watchpoints, with a
+// console on stdin/stderr for when one of them stops the machine.
+//
+// None of it costs anything until something is set: run_frame only switches
+// to its instrumented loop (a PC check before every instruction) while the
+// debugger is active, and watchpoints work by taking the pages they cover out
+// of the MMU's page tables, so only accesses to those pages reach
+// read_slow/write_slow, where the exact range is checked. Instruction fetches
+// are reads too, rom pages with a read watchpoint also skip the decode cache.
+//
+// Console commands (addresses and values in hex):
+//   c                                continue
+//   s [N]                            step N instructions (default 1)
+//   r                                registers
+//   b ADDR [if LHS OP VALUE]         break at PC ADDR, LHS is a register (a f b c d e h l
+//                                    af bc de hl sp) or a byte in memory ([ADDR]), OP is
+//                                    one of == != < <= > >=
+//   w FIRST[-LAST] [r|w|rw] [log|count]
+//                                    watch accesses to an address range (default rw), log
+//                                    prints every hit and count only counts them instead of
+//                                    stopping
+//   l                                list breakpoints and watchpoints with their hit counts
+//   d ID                             delete one
+//   x ADDR [N]                       dump N bytes of memory (default 16)
+//   q                                quit
+class Debugger {
+ public:
+    Debugger();
+    Gameboy* gameboy;
+
+    // anything set or a stop pending, run_frame uses the instrumented loop
+    bool active() const { return !breakpoints.empty() || !watchpoints.empty() || stop_pending; }
+    // stop before the next instruction
+    void request_stop(const std::string& why);
+    bool stopped() const { return is_stopped; }
+    // run-ahead frames get rolled back, so they don't hit, count, log or stop anything
+    void set_muted(bool muted) { this->muted = muted; }
+
+    // called by the instrumented loop before each instruction, true to stop
+    bool before_instruction();
+    // called by the MMU for accesses to a watched page
+    void watch_hit(int address, uint8_t value, bool write);
+    // reads commands until one resumes execution
+    void console();
+
+    // a console command, false (after printing why) when it couldn't be done
+    bool command(const std::string& line);
+    // hit counts, when anything was counted
+    void print_report(FILE* out) const;
+
+ private:
+    enum class Action { stop, log, count };
+    struct Condition {
+        // register name or "[ADDR]", empty for none
+        std::string lhs;
+        uint16_t address;
+        std::string op;
+        uint16_t value;
+    };
+    struct Breakpoint {
+        int id;
+        uint16_t pc;
+        Condition condition;
+        uint64_t hits;
+    };
+    struct Watchpoint {
+        int id;
+        uint16_t first;
+        uint16_t last;
+        bool read;
+        bool write;
+        Action action;
+        uint64_t hits;
+    };
+
+    std::vector<Breakpoint> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    // number of breakpoints per PC, so the check before each instruction is one load
+    std::vector<uint8_t> pc_breaks;
+    int next_id;
+
+    bool stop_pending;
+    bool is_stopped;
+    std::string stop_reason;
+    // instructions left to step, 0 when not stepping
+    long steps;
+    // the breakpoint execution just stopped at doesn't stop it again when continuing
+    int resume_pc;
+    // the debugger's own reads don't trigger watchpoints
+    bool peeking;
+    bool muted;
+
+    uint8_t peek(int address);
+    bool condition_holds(const Condition& condition);
+    void update_watched_pages();
+    void print_registers();
+    void print_list();
+};
@@ -0,0 +1,198 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "decode_cache.h"
+
+const uint32_t CACHE_MAGIC = 0x43444247; // "GBDC"
+// bump when Instruction or the walk changes
+const uint32_t CACHE_VERSION = 2;
+const int BANK_SIZE = 0x4000;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rom_hash;
+    uint64_t rom_size;
+    uint64_t instructions;
+};
+static_assert(sizeof(CacheHeader) % sizeof(Instruction) == 0);
+
+// Decodes everything reachable from the entry points into entries (one per rom byte),
+// returns how many instructions that was.
+static size_t walk(const std::vector<uint8_t>& rom, std::vector<Instruction>& entries) {
+    int banks = rom.size() / BANK_SIZE;
+    size_t count = 0;
+    // bank, address. Bank 0 is always at 0x0000, code in it can jump to 0x4000+ with any bank
+    // mapped, so those targets are followed in all of them
+    std::vector<std::pair<int, int>> work;
+    auto add_target = [&](int from_bank, int target) {
+        if (target < 0x4000) {
+            work.push_back({0, target});
+        } else if (target < 0x8000) {
+            if (from_bank != 0) {
+                work.push_back({from_bank, target});
+            } else {
+                for (int bank = 1; bank < banks; bank++)
+                    work.push_back({bank, target});
+            }
+        }
+        // code in ram is written at runtime, nothing to know ahead
+    };
+
+    work.push_back({0, 0x0100});
+    for (int vector = 0x00; vector <= 0x60; vector += 8)
+        work.push_back({0, vector});
+
+    while (!work.empty()) {
+        auto [bank, address] = work.back();
+        work.pop_back();
+        while (true) {
+            size_t offset = (size_t)bank * BANK_SIZE + (address & (BANK_SIZE - 1));
+            if (entries[offset].length)
+                break;
+            Instruction instr;
+            instr.opcode = rom[offset];
+            instr.length = instruction_length[instr.opcode];
+            if (instr.length == 0 || (address & (BANK_SIZE - 1)) + instr.length > BANK_SIZE)
+                break;
+            instr = decode_instruction(&rom[offset]);
+            entries[offset] = instr;
+            count++;
+
+            uint8_t op = instr.opcode;
+            int next = address + instr.length;
+            if (op == 0xC3) {
+                // jp nn
+                add_target(bank, instr.imm16());
+                break;
+            } else if (op == 0xCD || (op & 0xE7) == 0xC2 || (op & 0xE7) == 0xC4) {
+                // call nn, jp cc,nn, call cc,nn
+                add_target(bank, instr.imm16());
+            } else if (op == 0x18) {
+                add_target(bank, (next + (int8_t)instr.imm8()) & 0xFFFF);
+                break;
+            } else if ((op & 0xE7) == 0x20) {
+                // jr cc
+                add_target(bank, (next + (int8_t)instr.imm8()) & 0xFFFF);
+            } else if ((op & 0xC7) == 0xC7) {
+                // rst, which comes back
+                add_target(bank, op & 0x38);
+            } else if (op == 0xC9 || op == 0xD9 || op == 0xE9) {
+                // ret, reti, jp hl
+                break;
+            }
+
+            if (next >= 0x8000)
+                break;
+            if (bank == 0 && next >= 0x4000) {
+                // running off the end of bank 0 lands in whichever bank is mapped
+                add_target(0, next);
+                break;
+            }
+            address = next;
+        }
+    }
+    return count;
+}
+
+DecodeCache::DecodeCache() : data(nullptr), instruction_count(0), built_now(false), mapping(nullptr),
+                             mapping_size(0) {
+}
+
+DecodeCache::~DecodeCache() {
+    clear();
+}
+
+void DecodeCache::clear() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    built.clear();
+    built.shrink_to_fit();
+    data = nullptr;
+    instruction_count = 0;
+    built_now = false;
+    file_path.clear();
+}
+
+bool DecodeCache::map_file(uint64_t rom_hash, size_t rom_size) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    size_t expected = sizeof(CacheHeader) + rom_size * sizeof(Instruction);
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size != expected) {
+        close(fd);
+        return false;
+    }
+    void* memory = mmap(nullptr, expected, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+
+    CacheHeader header;
+    std::memcpy(&header, memory, sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.rom_hash != rom_hash ||
+        header.rom_size != rom_size) {
+        munmap(memory, expected);
+        return false;
+    }
+    mapping = memory;
+    mapping_size = expected;
+    data = (const Instruction*)((const uint8_t*)memory + sizeof(CacheHeader));
+    instruction_count = header.instructions;
+    return true;
+}
+
+void DecodeCache::load(const std::vector<uint8_t>& rom, uint64_t rom_hash, const std::string& dir) {
+    clear();
+    if (!dir.empty()) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.gbdc", (unsigned long long)rom_hash);
+        file_path = dir + name;
+        if (map_file(rom_hash, rom.size()))
+            return;
+    }
+
+    built.assign(rom.size(), Instruction{});
+    instruction_count = walk(rom, built);
+    data = built.data();
+    built_now = true;
+    if (dir.empty())
+        return;
+
+    // written next to the final name and renamed, so a crash never leaves half a cache behind
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    std::string temp_path = file_path + ".tmp";
+    CacheHeader header = {CACHE_MAGIC, CACHE_VERSION, rom_hash, rom.size(), instruction_count};
+    std::ofstream out(temp_path, std::ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)built.data(), built.size() * sizeof(Instruction));
+    out.close();
+    if (!out || std::rename(temp_path.c_str(), file_path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        file_path.clear();
+    }
+}
+
+std::string default_decode_cache_dir() {
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache)
+        return std::string(cache) + "/gameboy-emu";
+    if (const char* home = std::getenv("HOME"); home && *home)
+        return std::string(home) + "/.cache/gameboy-emu";
+    return "";
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+
+// Rom code decoded ahead of time, so fetching an instruction from rom is one
+// 4 byte load instead of up to three reads through the memory map.
+//
+// The first time a rom is seen, a static pass walks the code reachable from
+// the entry point and the rst/interrupt vectors, following jumps and calls
+// in every bank, and decodes every instruction it passes. The result, one
+// Instruction per rom byte (length 0 where no instruction starts), goes to
+// DIR/<rom hash>.gbdc and is mmap'd from there on later runs. Instructions
+// that run over the end of a 16 KiB bank aren't stored: what follows at
+// runtime is whatever bank is mapped, not the next one in the file. Code
+// the walk didn't reach (computed jumps, jump tables) is still decoded the
+// normal way when it runs, the cache only ever skips work.
+class DecodeCache {
+ public:
+    DecodeCache();
+    ~DecodeCache();
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    // maps the cache file for this rom, or builds and writes it. The cache still works
+    // when dir can't be written, it's just built again next time
+    void load(const std::vector<uint8_t>& rom, uint64_t rom_hash, const std::string& dir);
+    void clear();
+
+    // one entry per rom byte, null without a cache
+    const Instruction* entries() const { return data; }
+    size_t instructions() const { return instruction_count; }
+    // true when load() had to decode the rom, false when the file was mapped
+    bool was_built() const { return built_now; }
+    const std::string& path() const { return file_path; }
+
+ private:
+    const Instruction* data;
+    size_t instruction_count;
+    bool built_now;
+    std::string file_path;
+    void* mapping;
+    size_t mapping_size;
+    std::vector<Instruction> built;
+
+    bool map_file(uint64_t rom_hash, size_t rom_size);
+};
+
+// $XDG_CACHE_HOME/gameboy-emu or ~/.cache/gameboy-emu, empty when neither is set
+std::string default_decode_cache_dir();
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "frame_dump.h"
+#include "ppu.h"
+
+const int FRAME_PIXELS = GAMEBOY_DISPLAY_WIDTH * GAMEBOY_DISPLAY_HEIGHT;
+
+FrameDumper::FrameDumper() : file(nullptr), y4m(false), every(1), counter(0), written(0), dropped(0), running(false) {
+}
+
+FrameDumper::~FrameDumper() {
+    stop();
+}
+
+bool FrameDumper::start(std::string filepath, int every) {
+    file = filepath == "-" ? stdout : fopen(filepath.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return false;
+    }
+    y4m = filepath.size() >= 4 && filepath.compare(filepath.size() - 4, 4, ".y4m") == 0;
+    this->every = std::max(1, every);
+    counter = written = dropped = 0;
+    if (y4m) {
+        // the real frame rate is 4194304 / 70224 Hz
+        fprintf(file, "YUV4MPEG2 W%d H%d F4194304:%d Ip A1:1 C444\n", GAMEBOY_DISPLAY_WIDTH,
+                GAMEBOY_DISPLAY_HEIGHT, 70224 * this->every);
+    }
+    free_buffers.assign(QUEUE_FRAMES, std::vector<uint8_t>(FRAME_PIXELS * 4));
+    running = true;
+    thread = std::thread(&FrameDumper::loop, this);
+    return true;
+}
+
+void FrameDumper::stop() {
+    if (!file)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    ready.notify_one();
+    thread.join();
+    if (file != stdout)
+        fclose(file);
+    else
+        fflush(file);
+    file = nullptr;
+}
+
+void FrameDumper::push(const std::vector<uint8_t>& pixels) {
+    if (!file || counter++ % every != 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_buffers.empty()) {
+            dropped++;
+            return;
+        }
+        // the copy happens under the lock but it's only 92 KB, the writer never holds it while writing
+        queue.push_back(std::move(free_buffers.back()));
+        free_buffers.pop_back();
+        std::copy(pixels.begin(), pixels.end(), queue.back().begin());
+    }
+    ready.notify_one();
+}
+
+void FrameDumper::loop() {
+    std::vector<uint8_t> out(FRAME_PIXELS * 4 + 6);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        ready.wait(lock, [this] { return !running || !queue.empty(); });
+        if (queue.empty())
+            break;
+        std::vector<uint8_t> frame = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        write_frame(frame, out);
+        lock.lock();
+
+        free_buffers.push_back(std::move(frame));
+        written++;
+    }
+}
+
+void FrameDumper::write_frame(const std::vector<uint8_t>& pixels, std::vector<uint8_t>& out) {
+    size_t size;
+    if (y4m) {
+        // BT.601 studio range, planar Y then U then V
+        const char header[] = "FRAME\n";
+        std::copy(header, header + 6, out.begin());
+        uint8_t* y = &out[6];
+        uint8_t* u = y + FRAME_PIXELS;
+        uint8_t* v = u + FRAME_PIXELS;
+        for (int i = 0; i < FRAME_PIXELS; i++) {
+            int b = pixels[4 * i], g = pixels[4 * i + 1], r = pixels[4 * i + 2];
+            y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+        size = 6 + FRAME_PIXELS * 3;
+    } else {
+        for (int i = 0; i < FRAME_PIXELS; i++) {
+            out[4 * i] = pixels[4 * i + 2];
+            out[4 * i + 1] = pixels[4 * i + 1];
+            out[4 * i + 2] = pixels[4 * i];
+            out[4 * i + 3] = pixels[4 * i + 3];
+        }
+        size = FRAME_PIXELS * 4;
+    }
+    fwrite(out.data(), 1, size, file);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams rendered frames to a file or pipe on its own thread.
+//
+// .y4m paths get YUV4MPEG2 (4:4:4, plays in mpv/ffmpeg directly), anything else
+// raw RGBA, 160x144 per frame. "-" writes to stdout. push() only copies the
+// frame into a free buffer and never waits on the disk: when the queue is full
+// the frame is dropped and counted.
+class FrameDumper {
+ public:
+    static const size_t QUEUE_FRAMES = 64;
+
+    FrameDumper();
+    ~FrameDumper();
+    // every = dump one frame out of every N
+    bool start(std::string filepath, int every);
+    void stop();
+    bool is_open() const { return file != nullptr; }
+
+    // pixels in the renderer's BGRA layout
+    void push(const std::vector<uint8_t>& pixels);
+
+    uint64_t frames_written() const { return written; }
+    uint64_t frames_dropped() const { return dropped; }
+
+ private:
+    FILE* file;
+    bool y4m;
+    int every;
+    uint64_t counter;
+    uint64_t written;
+    uint64_t dropped;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool running;
+    std::deque<std::vector<uint8_t>> queue;
+    std::vector<std::vector<uint8_t>> free_buffers;
+    std::thread thread;
+
+    void loop();
+    void write_frame(const std::vector<uint8_t>& pixels, std::vector<uint8_t>& out);
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <chrono>
 #include <thread>
@@ -6,34 +7,48 @@
 #include <iostream>
 #include <array>
 #include <vector>
+#include <utility>
 
 #include "gameboy-emu.h"
 #include "cpu.h"
 #include "cartridge.h"
 #include "mmu.h"
+#include "apu.h"
+#include "audio_output.h"
+#include "ppu.h"
+#include "stats.h"
+#include "pacing.h"
+#include "joypad.h"
+#include "movie.h"
+#include "hash.h"
+#include "state.h"
+#include "test_runner.h"
+#include "regression.h"
+#include "frame_dump.h"
+#include "run_ahead.h"
+#include "render_bench.h"
+#include "tile_decode.h"
+#include "upscale.h"
+#include "input_latency.h"
+#include "decode_cache.h"
 
 #include <chrono>
 
 #include <SDL.h>
 #include <SDL_timer.h>
 
-int GAMEBOY_DISPLAY_WIDTH = 160;
-int GAMEBOY_DISPLAY_HEIGHT = 144;
-
-uint8_t Gameboy::read_cartridge(int address) {
-    return cartridge->read(address);
-}
-
-uint8_t Gameboy::read_mmu(int address) {
-    return mmu->read(address);
+Gameboy::Gameboy() {
+    mmu.gameboy = this;
+    cpu.gameboy = this;
+    joypad.gameboy = this;
+    ppu.gameboy = this;
+    debugger.gameboy = this;
+    mmu.map_cartridge();
 }
 
-void Gameboy::write_mmu(int address, uint8_t val) {
-    mmu->write(address, val);
-}
-
-void Gameboy::write_cartridge(int address, uint8_t val) {
-    cartridge->write(address, val);
+void Gameboy::load_cartridge(const std::string& filepath) {
+    cartridge.load(filepath);
+    mmu.map_cartridge();
 }
 
 void render_graphics0(SDL_Renderer *renderer, SDL_Surface *surface) {
@@ -63,10 +78,11 @@ void render_graphics0(SDL_Renderer *renderer, SDL_Surface *surface) {
     // SDL_RenderPresent(rend);
 }
 
-void render_graphics1(SDL_Renderer *renderer, SDL_Surface *surface, Gameboy gameboy) {
+void render_graphics1(SDL_Renderer *renderer, SDL_Surface *surface, Gameboy& gameboy) {
     // TODO: document what this function does/is for, is it for testing?
 
-    auto memory = *gameboy.mmu;
+    // scratch memory, so the random test pattern doesn't end up in the real vram
+    MMU memory;
 
     for (int i = 0xFE00; i < 0xFEA0; i++) {
         memory.write(i, std::rand() % 256);
@@ -150,127 +166,534 @@ void render_graphics1(SDL_Renderer *renderer, SDL_Surface *surface, Gameboy game
 }
 
 
-void render_graphics2(SDL_Renderer *renderer, SDL_Surface *surface, SDL_Texture *texture,std::vector<uint8_t> pixels, Gameboy gameboy) {
-    // TODO: document what this function does/is for, is it for testing?
+// pixels is width x height ARGB8888, the size of the texture
+void present_frame(SDL_Renderer *renderer, SDL_Texture *texture, const uint8_t* pixels, int width, int height) {
+    SDL_RenderClear(renderer);
 
-    auto mmu = *gameboy.mmu;
-
-    // // sprite addresses
-    // for (int i = 0xFE00; i < 0xFEA0; i++) {
-    //     mmu.write(i, std::rand() % 256);
-    // }
-    // for (int i = 0x8000; i < 0x9000; i++) {
-    //     mmu.write(i, std::rand() % 256);
-    // }
-
-    // // background addresses
-    // for (int i = 0x8000; i < 0x9800; i++) {
-    //     mmu.write(i, std::rand() % 256);
-    // }
-    // for (int i = 0x9800; i < 0xA000; i++) {
-    //     mmu.write(i, std::rand() % 256);
-    // }
-
-
-    // do pixel stuff
-    uint8_t lcdc = mmu.read(0xFF40);
-    int tile_map_base = 0x9800;
-    if (lcdc & (1 << 3))
-        tile_map_base = 0x9C00;
-
-    int tile_data_base = 0x8800;
-    if (lcdc & (1 << 4))
-        tile_data_base = 0x8000;
-
-    uint8_t scy = mmu.read(0xFF42);
-    uint8_t scx = mmu.read(0xFF43);
-
-    for (int j = 0; j < GAMEBOY_DISPLAY_HEIGHT; j++) {
-        int tile_map_y = ((scy + j) % 256) / 8;
-        for (int i = 0; i < GAMEBOY_DISPLAY_WIDTH; i++) {
-            int tile_map_x = ((scx + i) % 256) / 8;
-            int tile_map_index = tile_map_y * 32 + tile_map_x;
-
-            uint8_t tile_data_index = mmu.read(tile_map_base + tile_map_index);
-
-            int tile_data_pointer;
-            if (tile_data_base == 0x8000)
-                tile_data_pointer = tile_data_base + tile_data_index * 16;
-            else
-                tile_data_pointer = tile_data_base + ((int8_t)tile_data_index) * 16;
-
-            int x_offset = (scx + i) % 8;
-            int y_offset = (scy + j) % 8;
-
-            int lo_bits = mmu.read(tile_data_pointer + 2 * y_offset);
-            int hi_bits = mmu.read(tile_data_pointer + 2 * y_offset + 1);
-
-            int lo_bit = (lo_bits >> (7 - x_offset)) & 1;
-            int hi_bit = (hi_bits >> (7 - x_offset)) & 1;
-            int intensity = 3 - ((hi_bit << 1) | lo_bit);
-            pixels.at(4 * (160 * j + i))     = intensity * 255 / 3; // B
-            pixels.at(4 * (160 * j + i) + 1) = intensity * 255 / 3; // G
-            pixels.at(4 * (160 * j + i) + 2) = intensity * 255 / 3; // R
-            pixels.at(4 * (160 * j + i) + 3) = 255; // A //  what to set this to?
+    // write directly to surface instead? but how?
+
+    // null when the texture still holds this frame
+    if (pixels) {
+        unsigned char* locked_pixels = nullptr;
+        int pitch = 0;
+        // is reinterpret_cast necessary?
+        SDL_LockTexture(texture, nullptr, reinterpret_cast<void**>(&locked_pixels), &pitch);
+        // the texture's rows may be padded
+        for (int y = 0; y < height; y++)
+            std::copy_n(pixels + 4 * width * y, 4 * width, locked_pixels + pitch * y);
+        SDL_UnlockTexture(texture);
+    }
 
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+
+struct Options {
+    std::string rom_file;
+    std::string boot_rom;
+    bool overlay = false;
+    std::string stats_file;
+    int stats_interval_ms = 1000;
+    std::string pacing_report;
+    bool headless = false;
+    long frames = 0;
+    std::string record;
+    std::string play;
+    TestRunnerOptions test_roms;
+    RegressionOptions regression;
+    std::string dump;
+    int dump_every = 1;
+    int turbo = 0;
+    int run_ahead = 0;
+    bool render_bench = false;
+    bool decode_bench = false;
+    std::string decode_kernel;
+    int scale = 1;
+    std::string filter = "nearest";
+    bool scale_bench = false;
+    bool frame_input = false;
+    bool input_latency = false;
+    bool debug = false;
+    // b and w console commands without the letter, see debugger.h
+    std::vector<std::string> breakpoints;
+    std::vector<std::string> watchpoints;
+    // empty for no decode cache
+    std::string decode_cache = default_decode_cache_dir();
+};
+
+// one frame is 70224 cycles at 4194304 Hz
+const std::chrono::nanoseconds FRAME_DURATION(16742706);
+
+void print_usage() {
+    std::cerr << "usage: gameboy-emu [options] rom_file [boot_rom]\n"
+              << "       gameboy-emu --test-roms DIR [--jobs N] [--timeout-frames N] [--report FILE]\n"
+              << "       gameboy-emu --regress DIR [--jobs N] [--frames N] [--update-golden]\n"
+              << "       gameboy-emu --bench-render [--frames N]\n"
+              << "       gameboy-emu --bench-decode [--frames N]\n"
+              << "       gameboy-emu --bench-scale [--frames N]\n"
+              << "  --overlay             show the performance overlay (toggle with F1)\n"
+              << "  --scale N             upscale the window N times (2-6) on a worker thread\n"
+              << "  --filter NAME         upscaling filter: nearest (default), scale2x (even scales) or lcd\n"
+              << "  --stats-file FILE     append runtime statistics to FILE as CSV\n"
+              << "  --stats-interval MS   how often to write statistics (default 1000)\n"
+              << "  --pacing-report FILE  write frame time histograms to FILE (.json or .csv) on exit or SIGUSR1\n"
+              << "  --turbo N             fast-forward speed when toggled with Tab (default 0 = uncapped)\n"
+              << "  --run-ahead N         show the frame N frames ahead of the real one to hide the game's input lag\n"
+              << "  --frame-input         sample the keyboard once per frame instead of on every joypad read\n"
+              << "  --input-latency       print input-to-photon latency on exit\n"
+              << "  --decode-cache DIR    where rom code decoded ahead of time is kept (default ~/.cache/gameboy-emu)\n"
+              << "  --no-decode-cache     decode every instruction at runtime\n"
+              << "  --debug               stop in the debugger console before the first instruction (F6 stops later)\n"
+              << "  --break SPEC          breakpoint, \"ADDR\" or \"ADDR if LHS OP VALUE\" (see README)\n"
+              << "  --watch SPEC          watchpoint, \"FIRST[-LAST] [r|w|rw] [log|count]\"\n"
+              << "  --record FILE         record input from power-on to a movie file (F5 records from the current state)\n"
+              << "  --play FILE           replay a movie file\n"
+              << "  --headless            run without window, audio or frame limit and print result hashes\n"
+              << "  --frames N            number of frames to run headless (default: movie length)\n"
+              << "  --dump FILE           stream frames to FILE (.y4m for YUV4MPEG2, raw RGBA otherwise, - for stdout)\n"
+              << "  --dump-every N        only dump every Nth frame\n"
+              << "  --test-roms DIR       run every test rom under DIR and report pass/fail\n"
+              << "  --jobs N              test roms to run in parallel (default: all cores)\n"
+              << "  --timeout-frames N    frames before a test rom counts as hung (default 3600)\n"
+              << "  --report FILE         write test results as JUnit XML (.xml) or JSON\n"
+              << "  --regress DIR         compare per-frame framebuffer hashes of the roms under DIR with golden files\n"
+              << "  --update-golden       rewrite the golden files instead of comparing\n"
+              << "  --bench-render        time the renderer on synthetic scenes (default 2000 frames each)\n"
+              << "  --bench-decode        check the tile decode kernels against each other and time them (--frames lines)\n"
+              << "  --bench-scale         check and time every upscaling filter at every scale (default 200 frames)\n"
+              << "  --decode-kernel NAME  force the tile decode kernel: scalar, sse2 or avx2 (default: best supported)\n";
+}
+
+bool parse_options(int argc, char *argv[], Options& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--overlay") {
+            options.overlay = true;
+        } else if (arg == "--scale" && has_value) {
+            options.scale = std::stoi(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--stats-file" && has_value) {
+            options.stats_file = argv[++i];
+        } else if (arg == "--stats-interval" && has_value) {
+            options.stats_interval_ms = std::stoi(argv[++i]);
+        } else if (arg == "--pacing-report" && has_value) {
+            options.pacing_report = argv[++i];
+        } else if (arg == "--turbo" && has_value) {
+            options.turbo = std::stoi(argv[++i]);
+        } else if (arg == "--run-ahead" && has_value) {
+            options.run_ahead = std::stoi(argv[++i]);
+        } else if (arg == "--frame-input") {
+            options.frame_input = true;
+        } else if (arg == "--input-latency") {
+            options.input_latency = true;
+        } else if (arg == "--decode-cache" && has_value) {
+            options.decode_cache = argv[++i];
+        } else if (arg == "--no-decode-cache") {
+            options.decode_cache.clear();
+        } else if (arg == "--debug") {
+            options.debug = true;
+        } else if (arg == "--break" && has_value) {
+            options.breakpoints.push_back(argv[++i]);
+        } else if (arg == "--watch" && has_value) {
+            options.watchpoints.push_back(argv[++i]);
+        } else if (arg == "--record" && has_value) {
+            options.record = argv[++i];
+        } else if (arg == "--play" && has_value) {
+            options.play = argv[++i];
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames" && has_value) {
+            options.frames = options.regression.frames = std::stol(argv[++i]);
+        } else if (arg == "--dump" && has_value) {
+            options.dump = argv[++i];
+        } else if (arg == "--dump-every" && has_value) {
+            options.dump_every = std::stoi(argv[++i]);
+        } else if (arg == "--test-roms" && has_value) {
+            options.test_roms.directory = argv[++i];
+        } else if (arg == "--jobs" && has_value) {
+            options.test_roms.jobs = options.regression.jobs = std::stoi(argv[++i]);
+        } else if (arg == "--timeout-frames" && has_value) {
+            options.test_roms.timeout_frames = std::stol(argv[++i]);
+        } else if (arg == "--report" && has_value) {
+            options.test_roms.report = argv[++i];
+        } else if (arg == "--regress" && has_value) {
+            options.regression.directory = argv[++i];
+        } else if (arg == "--update-golden") {
+            options.regression.update = true;
+        } else if (arg == "--bench-render") {
+            options.render_bench = true;
+        } else if (arg == "--bench-decode") {
+            options.decode_bench = true;
+        } else if (arg == "--bench-scale") {
+            options.scale_bench = true;
+        } else if (arg == "--decode-kernel" && has_value) {
+            options.decode_kernel = argv[++i];
+        } else if (arg.starts_with("--")) {
+            std::cerr << "unknown option " << arg << "\n";
+            return false;
+        } else {
+            positional.push_back(arg);
         }
     }
+    if (!options.test_roms.directory.empty() || !options.regression.directory.empty() || options.render_bench ||
+        options.decode_bench || options.scale_bench)
+        return positional.empty();
+    if (positional.size() < 1 || positional.size() > 2)
+        return false;
+    options.rom_file = positional[0];
+    if (positional.size() == 2)
+        options.boot_rom = positional[1];
+    return true;
+}
 
-    SDL_RenderClear(renderer);
 
-    // write directly to surface instead? but how?
+int Gameboy::run_frame() {
+    // the instrumented loop only while there is a breakpoint, watchpoint or stop to look out for
+    if (debugger.active()) [[unlikely]]
+        return run_frame_loop<true>();
+    return run_frame_loop<false>();
+}
+
+template <bool DEBUG>
+int Gameboy::run_frame_loop() {
+    int instructions = 0;
+    bool vblank = false;
+    while (frame_cycles < CYCLES_PER_FRAME) {
+        // cpu.print_state();
+        // the common case, nothing pending, is one load and test without leaving this loop
+        int instr_cycles = mmu.interrupts_pending() ? cpu.handle_interrupts() : 0;
+
+        if (cpu.halted) [[unlikely]] {
+            // interrupts are only raised by ppu events (or by the cpu itself),
+            // so a halted cpu can sleep until the next one in one step
+            instr_cycles += std::max(ppu.next_event - ppu.line_cycles, 4);
+        } else {
+            if constexpr (DEBUG) {
+                if (debugger.before_instruction())
+                    debugger.console();
+            }
+            // fetch instruction
+            auto instr = cpu.fetch();
 
-    unsigned char* locked_pixels = nullptr;
-    int pitch = 0;
-    // is reinterpret_cast necessary?
-    SDL_LockTexture(texture, nullptr, reinterpret_cast<void**>(&locked_pixels), &pitch);
-    // std::copy_n(pixels.data(), pixels.size(), locked_pixels);
-    std::copy(pixels.begin(), pixels.end(), locked_pixels);
-    SDL_UnlockTexture(texture);
+            // execute instruction
+            instr_cycles += cpu.execute(instr);
+            instructions++;
+        }
 
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
+        frame_cycles += instr_cycles;
+        ppu.line_cycles += instr_cycles;
+        apu.tick(instr_cycles);
+        if (mmu.dma_active()) [[unlikely]]
+            mmu.tick_dma(instr_cycles);
 
+        if (ppu.line_cycles >= ppu.next_event && ppu.step()) {
+            vblank = true;
+            break;
+        }
+    }
+    // with the lcd on, vblank comes every CYCLES_PER_FRAME, turning it back on moves
+    // the frame boundary to the next vblank
+    frame_cycles = vblank ? ppu.line_cycles : frame_cycles - CYCLES_PER_FRAME;
+    return instructions;
 }
 
+const uint32_t STATE_MAGIC = 0x54534247; // "GBST"
+
+void Gameboy::save_state(std::vector<uint8_t>& out) {
+    out.clear();
+    StateWriter state(out);
+    state.write(STATE_MAGIC);
+    state.write(frame_cycles);
+    cpu.save_state(state);
+    cartridge.save_state(state);
+    mmu.save_state(state);
+    apu.save_state(state);
+    joypad.save_state(state);
+    ppu.save_state(state);
+}
+
+void Gameboy::load_state(const std::vector<uint8_t>& in) {
+    StateReader state(in);
+    uint32_t magic;
+    state.read(magic);
+    if (magic != STATE_MAGIC)
+        throw std::runtime_error("not a save state");
+    state.read(frame_cycles);
+    cpu.load_state(state);
+    cartridge.load_state(state);
+    mmu.load_state(state);
+    apu.load_state(state);
+    joypad.load_state(state);
+    ppu.load_state(state);
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+// keyboard layout: arrows, Z = A, X = B, Enter = Start, Backspace/Right Shift = Select
+const std::pair<SDL_Keycode, uint8_t> KEY_BUTTONS[] = {
+    {SDLK_RIGHT, BUTTON_RIGHT}, {SDLK_LEFT, BUTTON_LEFT}, {SDLK_UP, BUTTON_UP}, {SDLK_DOWN, BUTTON_DOWN},
+    {SDLK_z, BUTTON_A}, {SDLK_x, BUTTON_B}, {SDLK_RETURN, BUTTON_START}, {SDLK_BACKSPACE, BUTTON_SELECT},
+    {SDLK_RSHIFT, BUTTON_SELECT},
+};
+const int KEY_COUNT = sizeof(KEY_BUTTONS) / sizeof(KEY_BUTTONS[0]);
+
+// The keyboard as the joypad's live input. Pumping SDL's event queue has to
+// happen on the thread that owns the window, which is also the one running
+// the emulation, so a P1 read in the middle of a frame can look at the
+// keyboard right then. The events stay queued for the frame loop, only the
+// keyboard state is read here.
+class SdlInput : public InputSource {
+ public:
+    explicit SdlInput(InputLatency& latency) : latency(latency), buttons(0) {
+        // keycodes, so Z and X follow the keyboard layout
+        for (int i = 0; i < KEY_COUNT; i++)
+            scancodes[i] = SDL_GetScancodeFromKey(KEY_BUTTONS[i].first);
+    }
+
+    uint8_t poll() {
+        SDL_PumpEvents();
+        const Uint8* keys = SDL_GetKeyboardState(nullptr);
+        uint8_t pressed = 0;
+        for (int i = 0; i < KEY_COUNT; i++) {
+            if (keys[scancodes[i]])
+                pressed |= KEY_BUTTONS[i].second;
+        }
+        if (pressed != buttons)
+            latency.input();
+        buttons = pressed;
+        return buttons;
+    }
+
+    uint8_t sample() override {
+        uint8_t result = poll();
+        latency.read();
+        return result;
+    }
+
+ private:
+    InputLatency& latency;
+    uint8_t buttons;
+    SDL_Scancode scancodes[KEY_COUNT];
+};
+
+void write_exit_reports(Gameboy& gameboy) {
+#ifdef GB_PROFILE
+    gameboy.cpu.profiler.dump_json("profile.json");
+    gameboy.cpu.profiler.dump_folded("profile.folded");
+    std::cerr << "wrote profile.json and profile.folded" << std::endl;
+#endif
+#ifdef GB_MEMSTATS
+    gameboy.mmu.memstats.dump_json("memstats.json");
+    std::cerr << "wrote memstats.json and memheat.csv" << std::endl;
+#endif
+    gameboy.debugger.print_report(stderr);
+}
+
+void print_dump_summary(FrameDumper& dumper) {
+    if (!dumper.is_open())
+        return;
+    dumper.stop();
+    fprintf(stderr, "dump: %llu frames written, %llu dropped\n", (unsigned long long)dumper.frames_written(),
+            (unsigned long long)dumper.frames_dropped());
+}
+
+// runs without a window, audio or frame pacing, as fast as the core goes
+// warm-up throughput is measured over this many frames at the start
+const int WARMUP_FRAMES = 60;
+
+int run_headless(Gameboy& gameboy, const Options& options, const Movie* movie, FrameDumper& dumper,
+                 std::chrono::steady_clock::time_point launched) {
+    long frames = options.frames;
+    if (frames == 0 && movie)
+        frames = movie->inputs.size();
+    if (frames == 0) {
+        std::cerr << "--headless needs --frames or --play\n";
+        return 1;
+    }
+
+    std::vector<uint8_t> pixels(160 * 144 * 4, 0);
+    uint64_t instructions = 0;
+    long unchanged_frames = 0;
+    RunAhead run_ahead(options.run_ahead);
+    auto start = std::chrono::steady_clock::now();
+    double first_frame_ms = 0;
+    double warmup_seconds = 0;
+
+    for (long frame = 0; frame < frames; frame++) {
+        if (movie)
+            gameboy.joypad.set_buttons(frame < (long)movie->inputs.size() ? movie->inputs[frame] : 0);
+        instructions += gameboy.run_frame();
+#ifdef GB_MEMSTATS
+        gameboy.mmu.memstats.end_frame();
+#endif
+        gameboy.apu.end_frame();
+        gameboy.apu.clear_samples();
+        if (run_ahead.frames > 0)
+            run_ahead.run(gameboy);
+        if (!render_if_changed(pixels, gameboy))
+            unchanged_frames++;
+        dumper.push(pixels);
+        if (run_ahead.frames > 0)
+            run_ahead.restore(gameboy);
+        if (frame == 0)
+            first_frame_ms = elapsed_ns(launched, std::chrono::steady_clock::now()) / 1e6;
+        if (frame == WARMUP_FRAMES - 1)
+            warmup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<uint8_t> state;
+    gameboy.save_state(state);
+
+    // keep the results out of the video when frames go to stdout
+    FILE* out = options.dump == "-" ? stderr : stdout;
+    fprintf(out, "frames: %ld\n", frames);
+    fprintf(out, "time: %.3f s (%.1f fps, %.2fx)\n", seconds, frames / seconds, frames / seconds / 59.7275);
+    fprintf(out, "first frame: %.2f ms after launch\n", first_frame_ms);
+    if (frames >= WARMUP_FRAMES)
+        fprintf(out, "first %d frames: %.1f fps\n", WARMUP_FRAMES, WARMUP_FRAMES / warmup_seconds);
+    fprintf(out, "instructions: %llu\n", (unsigned long long)instructions);
+    fprintf(out, "unchanged frames: %ld (%.1f%%)\n", unchanged_frames, 100.0 * unchanged_frames / frames);
+    fprintf(out, "framebuffer hash: %016llx\n", (unsigned long long)hash64(pixels.data(), pixels.size()));
+    fprintf(out, "state hash: %016llx\n", (unsigned long long)hash64(state.data(), state.size()));
+    run_ahead.print_report(out);
+
+    write_exit_reports(gameboy);
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2 || argc > 3) {
-        std::cerr << "usage: gameboy-emu rom_file [boot_rom]\n";
+    auto launched = std::chrono::steady_clock::now();
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
         return 1;
     }
 
-    Gameboy gameboy = Gameboy();
+    if (!options.decode_kernel.empty()) {
+        DecodeKernel kernel;
+        if (!decode_kernel_from_name(options.decode_kernel, kernel) || !set_decode_kernel(kernel)) {
+            std::cerr << "decode kernel " << options.decode_kernel << " is not available\n";
+            return 1;
+        }
+    }
 
-    auto cartridge = Cartridge();
-    cartridge.load(std::string(argv[1]));
-    gameboy.cartridge = &cartridge;
+    if (!options.test_roms.directory.empty())
+        return run_test_roms(options.test_roms);
+    if (!options.regression.directory.empty())
+        return run_regression(options.regression);
+    if (options.render_bench)
+        return run_render_bench(options.frames ? options.frames : DEFAULT_RENDER_BENCH_FRAMES);
+    if (options.decode_bench)
+        return run_decode_bench(options.frames ? options.frames : DEFAULT_DECODE_BENCH_LINES);
+    if (options.scale_bench)
+        return run_scale_bench(options.frames ? options.frames : DEFAULT_SCALE_BENCH_FRAMES);
+
+    ScaleFilter filter;
+    if (!scale_filter_from_name(options.filter, filter)) {
+        std::cerr << "unknown filter " << options.filter << "\n";
+        return 1;
+    }
+    if (options.scale != 1 && !scale_supported(filter, options.scale)) {
+        std::cerr << options.filter << " can't scale " << options.scale << " times\n";
+        return 1;
+    }
 
-    auto mmu = MMU();
-    gameboy.mmu = &mmu;
-    mmu.gameboy = &gameboy;
-    if (argc == 3) {
-        mmu.load_boot_rom(std::string(argv[2]));
+    Gameboy gameboy;
+    Cartridge& cartridge = gameboy.cartridge;
+    MMU& mmu = gameboy.mmu;
+    CPU& cpu = gameboy.cpu;
+    APU& apu = gameboy.apu;
+    Joypad& joypad = gameboy.joypad;
+
+    gameboy.load_cartridge(options.rom_file);
+    if (!options.decode_cache.empty()) {
+        auto decode_start = std::chrono::steady_clock::now();
+        cartridge.load_decode_cache(options.decode_cache);
+        mmu.map_cartridge();
+        const DecodeCache& cache = cartridge.decoded();
+        double decode_ms = elapsed_ns(decode_start, std::chrono::steady_clock::now()) / 1e6;
+        if (!cache.was_built())
+            fprintf(stderr, "decode cache: %zu instructions mapped from %s in %.2f ms\n", cache.instructions(),
+                    cache.path().c_str(), decode_ms);
+        else if (!cache.path().empty())
+            fprintf(stderr, "decode cache: %zu instructions decoded in %.2f ms, wrote %s\n", cache.instructions(),
+                    decode_ms, cache.path().c_str());
+        else
+            fprintf(stderr, "decode cache: %zu instructions decoded in %.2f ms, %s isn't writable\n",
+                    cache.instructions(), decode_ms, options.decode_cache.c_str());
+    }
+    if (!options.boot_rom.empty()) {
+        mmu.load_boot_rom(options.boot_rom);
     } else {
         // disable bootrom, necessary for passing blargg test 07
         gameboy.write_mmu(0xFF50, 1);
     }
 
-    auto cpu = CPU();
-    gameboy.cpu = &cpu;
-    cpu.gameboy = &gameboy;
+    cpu.init(false);
+    // cpu.init(true);
+
+    for (const std::string& spec : options.breakpoints) {
+        if (!gameboy.debugger.command("b " + spec))
+            return 1;
+    }
+    for (const std::string& spec : options.watchpoints) {
+        if (!gameboy.debugger.command("w " + spec))
+            return 1;
+    }
+    if (options.debug)
+        gameboy.debugger.request_stop("--debug");
+
+#ifdef GB_MEMSTATS
+    mmu.memstats.open_heatmap("memheat.csv");
+#endif
+
+    Movie playback;
+    bool is_playing = !options.play.empty();
+    size_t playback_frame = 0;
+    if (is_playing) {
+        if (!playback.load(options.play))
+            return 1;
+        if (playback.rom_hash != cartridge.rom_hash()) {
+            std::cerr << options.play << " was recorded with a different rom\n";
+            return 1;
+        }
+        if (!playback.start_state.empty())
+            gameboy.load_state(playback.start_state);
+    }
+
+    FrameDumper dumper;
+    if (!options.dump.empty() && !dumper.start(options.dump, options.dump_every))
+        return 1;
+
+    if (options.headless) {
+        int result = run_headless(gameboy, options, is_playing ? &playback : nullptr, dumper, launched);
+        print_dump_summary(dumper);
+        return result;
+    }
 
     std::cerr << "starting execution" << std::endl;
-    int cycles = 0;
 
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         printf("error initializing SDL: %s\n", SDL_GetError());
     }
+    Upscaler upscaler;
+    if (options.scale > 1)
+        upscaler.start(filter, options.scale);
+    int window_width = GAMEBOY_DISPLAY_WIDTH * options.scale;
+    int window_height = GAMEBOY_DISPLAY_HEIGHT * options.scale;
+
     SDL_Window* win = SDL_CreateWindow("Gameboy",
                                        SDL_WINDOWPOS_CENTERED,
                                        SDL_WINDOWPOS_CENTERED,
-                                       GAMEBOY_DISPLAY_WIDTH,
-                                       GAMEBOY_DISPLAY_HEIGHT,
+                                       window_width,
+                                       window_height,
                                        0);
     if (win == NULL) {
         fprintf(stderr, "SDL window failed to initialise: %s\n", SDL_GetError());
@@ -281,84 +704,202 @@ int main(int argc, char *argv[]) {
     SDL_Event event;
 
     SDL_Renderer* renderer = SDL_CreateRenderer(win, -1, 0);
-    SDL_Surface* surface;
     SDL_Texture* texture = SDL_CreateTexture(
         renderer,
         SDL_PIXELFORMAT_ARGB8888,
         SDL_TEXTUREACCESS_STREAMING,
-        GAMEBOY_DISPLAY_WIDTH,
-        GAMEBOY_DISPLAY_HEIGHT
+        window_width,
+        window_height
     );
     std::vector<uint8_t> pixels(160 * 144 * 4, 0);
 
-
-    cpu.init(false);
-    // cpu.init(true);
-
-    int lcdy_cycles = 0;
-    // gameboy.write_mmu(0xFF44, 0x00);
-    gameboy.write_mmu(0xFF44, 0x90);
-
-    int total_cycles = 0;
-
-    std::chrono::time_point<std::chrono::high_resolution_clock> start, stop;
-    std::chrono::nanoseconds duration;
+    // when an audio device is available it paces emulation instead of sleep_until
+    AudioOutput audio;
+    audio.open(apu, 48000);
+
+    Stats stats;
+    StatsWriter stats_writer(stats);
+    if (!options.stats_file.empty())
+        stats_writer.start(options.stats_file, options.stats_interval_ms);
+    bool show_overlay = options.overlay;
+
+    PacingTelemetry pacing(FRAME_DURATION.count());
+    if (!options.pacing_report.empty())
+        install_pacing_signal_handler();
+
+    // --record starts at power-on, F5 starts (and stops) a recording from the current state
+    Movie recording;
+    bool is_recording = !options.record.empty();
+    std::string record_path = options.record.empty() ? "movie.gbm" : options.record;
+    recording.rom_hash = cartridge.rom_hash();
+    InputLatency latency;
+    SdlInput input(latency);
+    bool fast_forward = false;
+    RunAhead run_ahead(options.run_ahead);
+    // frames where nothing on screen changed, composition and texture upload were skipped
+    long unchanged_frames = 0;
+    long total_frames = 0;
+    // of the last rendered frame, only kept up with --input-latency
+    uint64_t frame_hash = 0;
 
     SDL_JoystickEventState(SDL_IGNORE);
 
-    start = std::chrono::high_resolution_clock::now();
-
-    bool started = false;
+    auto start = std::chrono::steady_clock::now();
 
-    // SDL_PollEvent(&event);
     while (is_running) {
-
-        // cpu.print_state();
-        cpu.handle_interrupts();
-
-        // fetch instruction
-        auto instr = cpu.fetch();
-
-        // execute instruction
-        int instr_cycles = cpu.execute(instr);
-
-        cycles += instr_cycles;
-        lcdy_cycles += instr_cycles;
-        total_cycles += instr_cycles;
-
-        if (lcdy_cycles >= 456) {
-            int temp = gameboy.read_mmu(0xFF44) + 1;
-            if (temp >= 154)
-                temp = 0;
-            gameboy.write_mmu(0xFF44, temp);
-            lcdy_cycles -= 456;
-        }
-
-        int cycles_per_frame = 70224;
-        int cycles_per_second = 4194304;
-
-        if (cycles > cycles_per_frame) {
-            // TODO: getting keyboard state should happen when
-            while (SDL_PollEvent(&event)) {
-                if (event.type == SDL_QUIT) {
-                    is_running = false;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                is_running = false;
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F1) {
+                show_overlay = !show_overlay;
+                // the overlay was drawn into pixels, an unchanged frame would keep showing (and dumping) it
+                gameboy.mmu.mark_video_dirty();
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F6 && !event.key.repeat) {
+                // the console reads stdin, so the window stops responding until it continues
+                gameboy.debugger.request_stop("F6");
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_TAB && !event.key.repeat) {
+                fast_forward = !fast_forward;
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F5 && !event.key.repeat) {
+                if (is_recording) {
+                    recording.save(record_path);
+                    std::cerr << "wrote " << recording.inputs.size() << " frames to " << record_path << std::endl;
+                    recording.inputs.clear();
+                    is_recording = false;
+                } else {
+                    gameboy.save_state(recording.start_state);
+                    is_recording = true;
+                    std::cerr << "recording to " << record_path << std::endl;
                 }
             }
-
-            cycles -= cycles_per_frame;
-            render_graphics2(renderer, surface, texture, pixels, gameboy);
-
-            std::this_thread::sleep_until(start + std::chrono::nanoseconds(16742706));
-            // std::this_thread::sleep_until(start + std::chrono::nanoseconds(15500000));
-            stop = std::chrono::high_resolution_clock::now();
-            duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-            std::cout << "FPS: " << 1L * 1000 * 1000 * 1000 / duration.count() << std::endl;
-            start = std::chrono::high_resolution_clock::now();
         }
+        // movies hold one input per frame, so while one is recorded or played the
+        // keyboard is only looked at here
+        joypad.source = is_recording || is_playing || options.frame_input ? nullptr : &input;
+
+        // fast-forward runs several frames per host frame and only renders the last one, the
+        // skipped ones still go through run_frame so LY and the interrupts see every line
+        int instructions = 0;
+        int emulated_frames = 0;
+        for (int frame = 0; ; frame++) {
+            // the movie drives input until it runs out, then the keyboard takes over
+            uint8_t buttons = input.poll();
+            if (is_playing) {
+                if (playback_frame < playback.inputs.size())
+                    buttons = playback.inputs[playback_frame++];
+                else
+                    is_playing = false;
+            }
+            joypad.set_buttons(buttons);
+            if (is_recording)
+                recording.inputs.push_back(buttons);
+
+            instructions += gameboy.run_frame();
+            emulated_frames++;
+#ifdef GB_MEMSTATS
+            mmu.memstats.end_frame();
+#endif
+            apu.end_frame();
+
+            if (!fast_forward)
+                break;
+            // nobody wants to hear 8x speed audio
+            apu.clear_samples();
+            if (options.turbo > 0 ? frame + 1 >= options.turbo
+                                  : std::chrono::steady_clock::now() - start >= FRAME_DURATION)
+                break;
+        }
+        // the ahead frames are muted, so the real frame's audio stays queued in the apu
+        bool is_ahead = run_ahead.frames > 0 && !fast_forward;
+        // the ahead frames get thrown away, their cost shows in the cpu time and run-ahead's own report
+        if (is_ahead)
+            run_ahead.run(gameboy);
+        auto cpu_done = std::chrono::steady_clock::now();
+
+        // the overlay is drawn into pixels, so with it on every frame is a new one
+        if (show_overlay)
+            gameboy.mmu.mark_video_dirty();
+        bool changed = render_if_changed(pixels, gameboy);
+        if (!changed)
+            unchanged_frames++;
+        else if (options.input_latency)
+            frame_hash = hash64(pixels.data(), pixels.size());
+        total_frames++;
+        dumper.push(pixels);
+        if (show_overlay)
+            draw_stats_overlay(pixels, stats);
+        // scaling runs on the upscaler's thread while the snapshot is restored,
+        // present only waits for it if it isn't done by then
+        if (upscaler.is_running() && changed)
+            upscaler.submit(pixels);
+        if (is_ahead)
+            run_ahead.restore(gameboy);
+        auto render_done = std::chrono::steady_clock::now();
+
+        if (!changed)
+            present_frame(renderer, texture, nullptr, window_width, window_height);
+        else if (upscaler.is_running())
+            present_frame(renderer, texture, (const uint8_t*)upscaler.result().data(), window_width, window_height);
+        else
+            present_frame(renderer, texture, pixels.data(), GAMEBOY_DISPLAY_WIDTH, GAMEBOY_DISPLAY_HEIGHT);
+        auto present_done = std::chrono::steady_clock::now();
+        latency.presented(frame_hash);
+
+        int64_t oversleep_ns = -1;
+        if (fast_forward && options.turbo == 0) {
+            // uncapped, the emulation loop above already used up the frame
+        } else if (audio.is_open && !fast_forward) {
+            audio.push(apu);
+            audio.wait();
+        } else {
+            apu.clear_samples();
+            auto deadline = start + FRAME_DURATION;
+            std::this_thread::sleep_until(deadline);
+            if (present_done < deadline)
+                oversleep_ns = elapsed_ns(deadline, std::chrono::steady_clock::now());
+        }
+        auto stop = std::chrono::steady_clock::now();
+
+        stats.record_frame(elapsed_ns(start, cpu_done), elapsed_ns(cpu_done, render_done),
+                           elapsed_ns(render_done, present_done), elapsed_ns(present_done, stop),
+                           elapsed_ns(start, stop), instructions, emulated_frames);
+        pacing.record(elapsed_ns(start, cpu_done), elapsed_ns(cpu_done, render_done),
+                      elapsed_ns(render_done, present_done), elapsed_ns(present_done, stop),
+                      elapsed_ns(start, stop), oversleep_ns);
+        if (!options.pacing_report.empty() && pacing_report_requested())
+            pacing.write_report(options.pacing_report);
+        start = stop;
+    }
 
+    if (is_recording) {
+        recording.save(record_path);
+        std::cerr << "wrote " << recording.inputs.size() << " frames to " << record_path << std::endl;
     }
 
+    if (!options.pacing_report.empty())
+        pacing.write_report(options.pacing_report);
+
+    stats_writer.stop();
+    print_dump_summary(dumper);
+    run_ahead.print_report(stderr);
+    if (options.input_latency)
+        latency.print_report(stderr);
+    if (total_frames > 0)
+        fprintf(stderr, "unchanged frames: %ld of %ld (%.1f%%)\n", unchanged_frames, total_frames,
+                100.0 * unchanged_frames / total_frames);
+    audio.close();
     SDL_DestroyTexture(texture);
 
+    write_exit_reports(gameboy);
+
+    if (apu.emulated_cycles > 0) {
+#ifdef GB_PROFILE
+        double emulated_seconds = (double)apu.emulated_cycles / APU::CLOCK_RATE;
+        fprintf(stderr, "audio: %.1f us synthesis per emulated second, %d buffer underruns\n",
+                apu.run_ns / 1000.0 / emulated_seconds, audio.underruns);
+#else
+        fprintf(stderr, "audio: %d buffer underruns\n", audio.underruns);
+#endif
+    }
+
     return 0;
 }
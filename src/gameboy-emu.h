@@ -1,15 +1,98 @@
+#pragma once
+
 #include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "mmu.h"
+#include "cpu.h"
+#include "apu.h"
+#include "joypad.h"
+#include "ppu.h"
+#include "debugger.h"
 
-class Cartridge;
-class MMU;
-class CPU;
+const int CYCLES_PER_FRAME = 70224;
+
+// The whole machine. The components are members rather than pointers so the
+// compiler sees one layout, and the memory hot path (cpu -> read_mmu ->
+// MMU::read -> Cartridge::read) is defined inline below so it collapses into
+// the instruction handlers instead of three out-of-line calls per access.
+//
+// Member order is layout: the cpu registers and frame counters come first so
+// they share the first cache lines, then the MMU's page tables and ram.
 class Gameboy {
  public:
-    Cartridge* cartridge;
-    MMU* mmu;
-    CPU* cpu;
-    uint8_t read_cartridge(int address);
-    uint8_t read_mmu(int address);
-    void write_mmu(int address, uint8_t val);
-    void write_cartridge(int address, uint8_t val);
+    CPU cpu;
+    int frame_cycles = 0;
+    PPU ppu;
+    MMU mmu;
+    Cartridge cartridge;
+    APU apu;
+    Joypad joypad;
+    ObjectLines object_lines;
+    // bytes sent over the link cable, test roms print their results there
+    std::string serial_output;
+    Debugger debugger;
+
+    Gameboy();
+    // loads the rom and maps its banks into memory
+    void load_cartridge(const std::string& filepath);
+    // the components point back at their owner
+    Gameboy(const Gameboy&) = delete;
+    Gameboy& operator=(const Gameboy&) = delete;
+
+    // runs until vblank starts (or a frame's worth of cycles with the lcd off), returns how many instructions were executed
+    int run_frame();
+    void save_state(std::vector<uint8_t>& out);
+    void load_state(const std::vector<uint8_t>& in);
+
+    uint8_t read_cartridge(int address) {
+        return cartridge.read(address);
+    }
+
+    uint8_t read_mmu(int address) {
+        return mmu.read(address);
+    }
+
+    void write_mmu(int address, uint8_t val) {
+        mmu.write(address, val);
+    }
+
+    void write_cartridge(int address, uint8_t val) {
+        cartridge.write(address, val);
+        mmu.map_cartridge();
+    }
+
+ private:
+    // DEBUG checks breakpoints before every instruction
+    template <bool DEBUG>
+    int run_frame_loop();
 };
+
+// memory map hot path, everything that isn't plain memory goes through MMU::read_slow/write_slow
+
+inline uint8_t MMU::read(int address) {
+#ifdef GB_MEMSTATS
+    memstats.record_read(address, gameboy->cartridge.rom_bank());
+#endif
+    const uint8_t* page = read_map[address >> 8];
+    if (page)
+        return page[address & 0xFF];
+    if (address >= 0xFF80 && address < 0xFFFF && !(watched[0xFF] & WATCH_READ))
+        return memory.hram[address - 0xFF80];
+    return read_slow(address);
+}
+
+inline void MMU::write(int address, uint8_t data) {
+#ifdef GB_MEMSTATS
+    memstats.record_write(address, gameboy->cartridge.rom_bank());
+#endif
+    uint8_t* page = write_map[address >> 8];
+    if (page)
+        page[address & 0xFF] = data;
+    else if (address >= 0xFF80 && address < 0xFFFF && !(watched[0xFF] & WATCH_WRITE))
+        memory.hram[address - 0xFF80] = data;
+    else
+        write_slow(address, data);
+}
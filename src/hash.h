@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Fast non-cryptographic 64-bit hash (xxHash64-style round and avalanche),
+// used for ROM identity and framebuffer comparisons.
+
+const uint64_t HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t HASH_PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t HASH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t HASH_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t hash64(const void* data, size_t len, uint64_t seed = 0) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t h = seed + HASH_PRIME5 + len;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h ^= hash_rotl(word * HASH_PRIME2, 31) * HASH_PRIME1;
+        h = hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    for (; len > 0; len--, p++) {
+        h ^= *p * HASH_PRIME5;
+        h = hash_rotl(h, 11) * HASH_PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
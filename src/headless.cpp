@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "headless.h"
+
+HeadlessMachine::HeadlessMachine(const std::string& rom_file) {
+    gameboy.load_cartridge(rom_file);
+    gameboy.write_mmu(0xFF50, 1);
+    gameboy.cpu.init(false);
+}
+
+int HeadlessMachine::run_frame() {
+    int instructions = gameboy.run_frame();
+    gameboy.apu.end_frame();
+    gameboy.apu.clear_samples();
+    return instructions;
+}
+
+int run_parallel(size_t count, int jobs, const std::function<void(size_t)>& work) {
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<size_t>(jobs, std::max<size_t>(1, count));
+
+    // every item is independent, so workers just pull the next index
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            for (size_t index = next++; index < count; index = next++)
+                work(index);
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    return jobs;
+}
+
+std::vector<std::string> find_roms(const std::string& directory) {
+    std::vector<std::string> roms;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        std::string ext = it->path().extension().string();
+        if (it->is_regular_file() && (ext == ".gb" || ext == ".gbc"))
+            roms.push_back(it->path().string());
+    }
+    if (ec)
+        throw std::runtime_error(directory + ": " + ec.message());
+    std::sort(roms.begin(), roms.end());
+    return roms;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "gameboy-emu.h"
+
+// A whole machine with no window or audio device, started past the boot rom.
+// The test and regression runners build one per rom on their worker threads.
+struct HeadlessMachine {
+    Gameboy gameboy;
+
+    explicit HeadlessMachine(const std::string& rom_file);
+
+    // runs one frame and throws the audio away
+    int run_frame();
+};
+
+// calls work(0..count-1) from up to jobs threads (0 = one per core), returns the thread count used
+int run_parallel(size_t count, int jobs, const std::function<void(size_t)>& work);
+
+// every .gb/.gbc below directory, sorted, throws std::runtime_error if it can't be read
+std::vector<std::string> find_roms(const std::string& directory);
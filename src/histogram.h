@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Log-linear (HDR style) histogram for nanosecond durations. Each power of
+// two range is split into SUB_BUCKETS linear buckets, so any recorded value
+// is reported within ~3% while the whole thing stays a fixed-size array
+// that is O(1) to update from the frame loop.
+class Histogram {
+ public:
+    static const int SUB_BITS = 6;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    // covers up to 2^42 ns (over an hour)
+    static const int MAGNITUDES = 42 - SUB_BITS + 1;
+
+    Histogram() {
+        reset();
+    }
+
+    void reset() {
+        buckets.fill(0);
+        count = 0;
+        sum = 0;
+        min = UINT64_MAX;
+        max = 0;
+    }
+
+    void record(uint64_t value) {
+        buckets[bucket_index(value)]++;
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    // value at or below which fraction p (0-1) of the samples fall, as the upper edge of its bucket
+    uint64_t percentile(double p) const {
+        if (count == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * count + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < (int)buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(max, bucket_upper(i));
+        }
+        return max;
+    }
+
+    uint64_t mean() const {
+        return count ? sum / count : 0;
+    }
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+
+ private:
+    std::array<uint64_t, MAGNITUDES * SUB_BUCKETS> buckets;
+
+    static int bucket_index(uint64_t value) {
+        if (value < SUB_BUCKETS)
+            return value;
+        int magnitude = std::bit_width(value) - 1;
+        int shift = magnitude - SUB_BITS + 1;
+        if (shift >= MAGNITUDES)
+            return MAGNITUDES * SUB_BUCKETS - 1;
+        // value >> shift always has its top bit set, so only the upper half of each
+        // range's buckets is used. wasteful, but keeps the index a shift and an add
+        return shift * SUB_BUCKETS + (int)(value >> shift);
+    }
+
+    static uint64_t bucket_upper(int index) {
+        if (index < SUB_BUCKETS)
+            return index;
+        int shift = index / SUB_BUCKETS;
+        uint64_t sub = index % SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+};
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <cstdio>
+
+#include "input_latency.h"
+
+static uint64_t ns_since(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - from).count();
+}
+
+InputLatency::InputLatency() : ignored(0), pending(false), was_read(false), frames(0), last_hash(0) {
+}
+
+void InputLatency::input() {
+    // a second change before the first one showed up still waits for the same frame,
+    // the oldest one is the one the player is waiting on
+    if (pending)
+        return;
+    pending = true;
+    was_read = false;
+    frames = 0;
+    input_time = std::chrono::steady_clock::now();
+}
+
+void InputLatency::read() {
+    if (!pending || was_read)
+        return;
+    was_read = true;
+    to_read.record(ns_since(input_time));
+}
+
+void InputLatency::presented(uint64_t frame_hash) {
+    bool changed = frame_hash != last_hash;
+    last_hash = frame_hash;
+    if (!pending)
+        return;
+    if (changed) {
+        to_photon.record(ns_since(input_time));
+        pending = false;
+    } else if (++frames >= MAX_FRAMES) {
+        ignored++;
+        pending = false;
+    }
+}
+
+void InputLatency::print_report(FILE* out) const {
+    if (to_photon.count == 0 && ignored == 0)
+        return;
+    fprintf(out, "input latency: %llu changes shown, %llu with no visible reaction\n",
+            (unsigned long long)to_photon.count, (unsigned long long)ignored);
+    fprintf(out, "  to photon: p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", to_photon.percentile(0.5) / 1e6,
+            to_photon.percentile(0.95) / 1e6, to_photon.max / 1e6);
+    if (to_read.count > 0)
+        fprintf(out, "  to joypad read: p50 %.2f ms, p95 %.2f ms, max %.2f ms\n", to_read.percentile(0.5) / 1e6,
+                to_read.percentile(0.95) / 1e6, to_read.max / 1e6);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "histogram.h"
+
+// Input-to-photon latency, measured on the host. A button change is stamped
+// when the frontend first sees it, then again when the game first reads P1
+// after it (only with live sampling) and when the first frame whose pixels
+// differ from the previous one has been presented (compared by hash, the
+// renderer's dirty flag also fires for OAM DMAs and scrolling that have
+// nothing to do with the press). That frame is taken to be the
+// game's reaction, so this is meant for screens that react to every press;
+// changes that show nothing within MAX_FRAMES frames aren't counted.
+class InputLatency {
+ public:
+    static const int MAX_FRAMES = 30;
+
+    InputLatency();
+    void input();
+    void read();
+    // frame_hash of the game's pixels, without the overlay
+    void presented(uint64_t frame_hash);
+    void print_report(FILE* out) const;
+
+    Histogram to_read;
+    Histogram to_photon;
+    uint64_t ignored;
+
+ private:
+    bool pending;
+    bool was_read;
+    int frames;
+    uint64_t last_hash;
+    std::chrono::steady_clock::time_point input_time;
+};
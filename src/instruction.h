@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// opcode -> length in bytes, 0 for the opcodes the cpu doesn't have. 0xCB is
+// 2, the CB opcode is its operand
+const std::array<uint8_t, 256> instruction_length = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,
+    2, 1, 1, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1,
+    2, 1, 1, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1,
+};
+
+// One decoded instruction, what the cpu executes. Plain data, 4 bytes, so a
+// whole rom's worth can live in a file (see DecodeCache).
+struct Instruction {
+    uint8_t opcode;
+    // 0 when there is no such instruction
+    uint8_t length;
+    // the bytes after the opcode, little endian: imm8, imm16 or the CB opcode
+    uint16_t operand;
+
+    uint8_t imm8() const { return operand & 0xFF; }
+    uint16_t imm16() const { return operand; }
+};
+static_assert(sizeof(Instruction) == 4);
+
+// decodes the instruction at bytes[0], reading only the bytes it's made of
+inline Instruction decode_instruction(const uint8_t* bytes) {
+    Instruction instr;
+    instr.opcode = bytes[0];
+    instr.length = instruction_length[instr.opcode];
+    instr.operand = 0;
+    if (instr.length > 1)
+        instr.operand = bytes[1];
+    if (instr.length > 2)
+        instr.operand |= bytes[2] << 8;
+    return instr;
+}
@@ -0,0 +1,58 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gameboy-emu.h"
+#include "joypad.h"
+#include "mmu.h"
+#include "state.h"
+
+const int JOYPAD_INTERRUPT_BIT = 1 << 4;
+
+Joypad::Joypad() {
+    gameboy = nullptr;
+    source = nullptr;
+    select = 0x30;
+    buttons = 0;
+    sampled_line = UINT32_MAX;
+}
+
+uint8_t Joypad::read() {
+    // games read P1 several times in a row to debounce it, one sample per line is plenty
+    if (source && gameboy->ppu.line_count != sampled_line) [[unlikely]] {
+        sampled_line = gameboy->ppu.line_count;
+        set_buttons(source->sample());
+    }
+    // bits 0-3 are active low and only report the selected group(s)
+    uint8_t result = 0xC0 | select | 0x0F;
+    if (!(select & 0x10))
+        result &= ~(buttons & 0x0F);
+    if (!(select & 0x20))
+        result &= ~(buttons >> 4);
+    return result;
+}
+
+void Joypad::write(uint8_t val) {
+    select = val & 0x30;
+}
+
+void Joypad::set_buttons(uint8_t mask) {
+    uint8_t pressed = mask & ~buttons;
+    buttons = mask;
+    if (pressed)
+        gameboy->mmu.request_interrupt(JOYPAD_INTERRUPT_BIT);
+}
+
+uint8_t Joypad::get_buttons() {
+    return buttons;
+}
+
+void Joypad::save_state(StateWriter& state) {
+    state.write(select);
+    state.write(buttons);
+}
+
+void Joypad::load_state(StateReader& state) {
+    state.read(select);
+    state.read(buttons);
+}
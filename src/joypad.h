@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+class Gameboy;
+class StateWriter;
+class StateReader;
+
+// button bits as used by set_buttons() and movie files, 1 = pressed
+const uint8_t BUTTON_RIGHT = 1 << 0;
+const uint8_t BUTTON_LEFT = 1 << 1;
+const uint8_t BUTTON_UP = 1 << 2;
+const uint8_t BUTTON_DOWN = 1 << 3;
+const uint8_t BUTTON_A = 1 << 4;
+const uint8_t BUTTON_B = 1 << 5;
+const uint8_t BUTTON_SELECT = 1 << 6;
+const uint8_t BUTTON_START = 1 << 7;
+
+// Where live buttons come from, implemented by the frontend. sample() runs on
+// the emulation thread, in the middle of a frame.
+class InputSource {
+ public:
+    virtual ~InputSource() = default;
+    virtual uint8_t sample() = 0;
+};
+
+// P1/JOYP register (0xFF00)
+class Joypad {
+ public:
+    Joypad();
+    Gameboy* gameboy;
+    // Live input, sampled when the game reads P1 (at most once per scanline) on
+    // top of set_buttons() at the start of each frame, so a press that arrives
+    // while the frame is being emulated is seen by this frame's joypad read.
+    // Null for movies and headless runs, which need input per whole frame.
+    InputSource* source;
+    uint8_t read();
+    void write(uint8_t val);
+    // requests the joypad interrupt when a button goes from released to pressed
+    void set_buttons(uint8_t mask);
+    uint8_t get_buttons();
+
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
+
+ private:
+    uint8_t select;
+    uint8_t buttons;
+    uint32_t sampled_line;
+};
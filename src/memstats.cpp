@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <string>
+
+#include "memstats.h"
+
+struct Region {
+    const char* name;
+    int start;
+    int end;
+};
+
+// page granularity regions, FE and FF are broken down further below
+const Region PAGE_REGIONS[] = {
+    {"rom0", 0x00, 0x40},
+    {"romx", 0x40, 0x80},
+    {"vram", 0x80, 0xA0},
+    {"eram", 0xA0, 0xC0},
+    {"wram", 0xC0, 0xE0},
+    {"echo", 0xE0, 0xFE},
+    {"oam", 0xFE, 0xFF},
+};
+
+MemStats::MemStats() {
+    reads.fill(0);
+    writes.fill(0);
+    frame_reads.fill(0);
+    frame_writes.fill(0);
+    io_reads.fill(0);
+    io_writes.fill(0);
+    bank_reads.fill(0);
+    bank_writes.fill(0);
+    heatmap = nullptr;
+    frame = 0;
+}
+
+MemStats::~MemStats() {
+    if (heatmap)
+        fclose(heatmap);
+}
+
+void MemStats::open_heatmap(std::string filepath) {
+    heatmap = fopen(filepath.c_str(), "w");
+    if (!heatmap) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return;
+    }
+    fprintf(heatmap, "frame,kind");
+    for (int page = 0; page < 256; page++)
+        fprintf(heatmap, ",%02X00", page);
+    fprintf(heatmap, "\n");
+}
+
+void MemStats::end_frame() {
+    if (heatmap) {
+        fprintf(heatmap, "%d,r", frame);
+        for (int page = 0; page < 256; page++)
+            fprintf(heatmap, ",%u", frame_reads[page]);
+        fprintf(heatmap, "\n%d,w", frame);
+        for (int page = 0; page < 256; page++)
+            fprintf(heatmap, ",%u", frame_writes[page]);
+        fprintf(heatmap, "\n");
+    }
+    frame_reads.fill(0);
+    frame_writes.fill(0);
+    frame++;
+}
+
+void MemStats::dump_json(std::string filepath) {
+    FILE* f = fopen(filepath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return;
+    }
+    auto ull = [](uint64_t v) { return (unsigned long long)v; };
+
+    fprintf(f, "{\n  \"frames\": %d,\n  \"regions\": {", frame);
+    for (const Region& region : PAGE_REGIONS) {
+        uint64_t r = 0;
+        uint64_t w = 0;
+        for (int page = region.start; page < region.end; page++) {
+            r += reads[page];
+            w += writes[page];
+        }
+        fprintf(f, "\n    \"%s\": {\"reads\": %llu, \"writes\": %llu},", region.name, ull(r), ull(w));
+    }
+    uint64_t io_r = 0, io_w = 0, hram_r = 0, hram_w = 0;
+    for (int i = 0; i < 0x80; i++) {
+        io_r += io_reads[i];
+        io_w += io_writes[i];
+    }
+    for (int i = 0x80; i < 0xFF; i++) {
+        hram_r += io_reads[i];
+        hram_w += io_writes[i];
+    }
+    fprintf(f, "\n    \"io\": {\"reads\": %llu, \"writes\": %llu},", ull(io_r), ull(io_w));
+    fprintf(f, "\n    \"hram\": {\"reads\": %llu, \"writes\": %llu},", ull(hram_r), ull(hram_w));
+    fprintf(f, "\n    \"ie\": {\"reads\": %llu, \"writes\": %llu}\n  },\n", ull(io_reads[0xFF]), ull(io_writes[0xFF]));
+
+    fprintf(f, "  \"rom_banks\": [");
+    bool first = true;
+    for (int bank = 0; bank < 512; bank++) {
+        if (bank_reads[bank] == 0 && bank_writes[bank] == 0)
+            continue;
+        fprintf(f, "%s\n    {\"bank\": %d, \"reads\": %llu, \"writes\": %llu}", first ? "" : ",", bank,
+                ull(bank_reads[bank]), ull(bank_writes[bank]));
+        first = false;
+    }
+
+    fprintf(f, "\n  ],\n  \"io_registers\": [");
+    first = true;
+    for (int i = 0; i < 0x80; i++) {
+        if (io_reads[i] == 0 && io_writes[i] == 0)
+            continue;
+        fprintf(f, "%s\n    {\"address\": \"0xFF%02X\", \"reads\": %llu, \"writes\": %llu}", first ? "" : ",", i,
+                ull(io_reads[i]), ull(io_writes[i]));
+        first = false;
+    }
+
+    fprintf(f, "\n  ],\n  \"pages\": [");
+    first = true;
+    for (int page = 0; page < 256; page++) {
+        if (reads[page] == 0 && writes[page] == 0)
+            continue;
+        fprintf(f, "%s\n    {\"page\": \"0x%02X00\", \"reads\": %llu, \"writes\": %llu}", first ? "" : ",", page,
+                ull(reads[page]), ull(writes[page]));
+        first = false;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+}
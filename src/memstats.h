@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Memory access counters for MMU::read/MMU::write. Only compiled in with
+// `make MEMSTATS=1` (defines GB_MEMSTATS), the hooks vanish otherwise.
+class MemStats {
+ public:
+    MemStats();
+    ~MemStats();
+
+    void record_read(int address, int rom_bank) {
+        reads[address >> 8]++;
+        frame_reads[address >> 8]++;
+        if (address >= 0xFF00)
+            io_reads[address & 0xFF]++;
+        else if (address >= 0x4000 && address < 0x8000)
+            bank_reads[rom_bank & 0x1FF]++;
+    }
+
+    void record_write(int address, int rom_bank) {
+        writes[address >> 8]++;
+        frame_writes[address >> 8]++;
+        if (address >= 0xFF00)
+            io_writes[address & 0xFF]++;
+        else if (address >= 0x4000 && address < 0x8000)
+            bank_writes[rom_bank & 0x1FF]++;
+    }
+
+    // appends this frame's per-page counts to the heatmap file (if open) and resets them
+    void end_frame();
+    void open_heatmap(std::string filepath);
+    // totals per region, per page and per I/O register
+    void dump_json(std::string filepath);
+
+ private:
+    std::array<uint64_t, 256> reads;
+    std::array<uint64_t, 256> writes;
+    std::array<uint32_t, 256> frame_reads;
+    std::array<uint32_t, 256> frame_writes;
+    // 0xFF00-0xFFFF by address, this covers I/O registers, HRAM and IE
+    std::array<uint64_t, 256> io_reads;
+    std::array<uint64_t, 256> io_writes;
+    std::array<uint64_t, 512> bank_reads;
+    std::array<uint64_t, 512> bank_writes;
+    FILE* heatmap;
+    int frame;
+};
@@ -1,61 +1,176 @@
+#include <algorithm>
 #include <vector>
 #include <array>
 #include <fstream>
 #include <string>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include "gameboy-emu.h"
 
 #include "mmu.h"
+#include "apu.h"
+#include "joypad.h"
+#include "state.h"
+
+const int SERIAL_INTERRUPT_BIT = 1 << 3;
+// games that spam the serial port shouldn't grow this forever
+const size_t MAX_SERIAL_OUTPUT = 1 << 20;
+// 160 bytes at one per machine cycle
+const int DMA_CYCLES = 640;
+// FF40-FF4B registers the renderer reads: LCDC, SCY, SCX, BGP, OBP0, OBP1, WY, WX
+const int VIDEO_REGISTERS = 0b1111'1000'1101;
+// LCDC bit 2, 8x16 objects
+const uint8_t LCDC_OBJ_SIZE = 1 << 2;
+// LCDC bit 7
+const uint8_t LCDC_ENABLE = 1 << 7;
 
 MMU::MMU() {
-    vram.resize(8192);
-    eram.resize(8192);
-    wram1.resize(4096);
-    wram2.resize(4096);
-    oam.resize(160);
-    not_usable.resize(96);
-    io_reg.resize(128);
-    hram.resize(127);
+    memory = {};
+    pending_interrupts = 0;
+    boot_rom.fill(0);
+    has_boot_rom = false;
+    gameboy = nullptr;
+
+    dma_cycles = 0;
+    video_changed = true;
+    watched.fill(0);
+    watching = false;
+    map_memory();
 }
 
-void MMU::load_boot_rom(std::string filepath) {
-    std::ifstream ifd(filepath, std::ios::binary | std::ios::ate);
-    std::streamsize size = ifd.tellg();
-    ifd.seekg(0, std::ios::beg);
-    boot_rom.resize(size);
-    ifd.read((char *)boot_rom.data(), size);
-}
-
-uint8_t MMU::read(int address) {
-    if (address < 0x4000) {
-        // 16 KiB ROM bank 00
-        if (address < 0x100 && !read(0xFF50)) {
-            return boot_rom.at(address);
-        } else {
-            return this->gameboy->read_cartridge(address);
+void MMU::map_memory() {
+    read_map.fill(nullptr);
+    write_map.fill(nullptr);
+    code_map.fill(nullptr);
+    // everything goes through read_slow/write_slow, which turn the cpu away
+    if (dma_cycles > 0)
+        return;
+
+    for (int page = 0x80; page < 0xA0; page++) {
+        read_map[page] = &memory.vram[(page - 0x80) << 8];
+        if (video_changed)
+            write_map[page] = &memory.vram[(page - 0x80) << 8];
+    }
+    for (int page = 0xC0; page < 0xE0; page++)
+        read_map[page] = write_map[page] = &memory.wram[(page - 0xC0) << 8];
+    if (gameboy)
+        map_cartridge();
+    unmap_watched();
+}
+
+void MMU::map_cartridge() {
+    if (dma_cycles > 0)
+        return;
+    Cartridge& cartridge = gameboy->cartridge;
+    for (int page = 0x00; page < 0x40; page++)
+        read_map[page] = cartridge.rom0 + (page << 8);
+    for (int page = 0x40; page < 0x80; page++)
+        read_map[page] = cartridge.romx + ((page - 0x40) << 8);
+    for (int page = 0x00; page < 0x40; page++)
+        code_map[page] = cartridge.decoded0 ? cartridge.decoded0 + (page << 8) : nullptr;
+    for (int page = 0x40; page < 0x80; page++)
+        code_map[page] = cartridge.decodedx ? cartridge.decodedx + ((page - 0x40) << 8) : nullptr;
+    if (has_boot_rom && !memory.io_reg[0x50]) {
+        read_map[0] = boot_rom.data();
+        code_map[0] = nullptr;
+    }
+
+    for (int page = 0xA0; page < 0xC0; page++) {
+        uint8_t* ram = cartridge.ram_page ? cartridge.ram_page + ((page - 0xA0) << 8) : nullptr;
+        read_map[page] = write_map[page] = ram;
+    }
+    unmap_watched();
+}
+
+void MMU::set_watched(const std::array<uint8_t, 256>& pages) {
+    watched = pages;
+    watching = std::any_of(watched.begin(), watched.end(), [](uint8_t bits) { return bits != 0; });
+    map_memory();
+}
+
+void MMU::unmap_watched() {
+    if (!watching)
+        return;
+    for (int page = 0; page < 0x100; page++) {
+        if (watched[page] & WATCH_READ) {
+            read_map[page] = nullptr;
+            // instruction fetches are reads too
+            if (page < 0x80)
+                code_map[page] = nullptr;
         }
+        if (watched[page] & WATCH_WRITE)
+            write_map[page] = nullptr;
+    }
+}
+
+void MMU::mark_video_dirty() {
+    if (video_changed)
+        return;
+    video_changed = true;
+    if (dma_cycles == 0) {
+        for (int page = 0x80; page < 0xA0; page++)
+            write_map[page] = &memory.vram[(page - 0x80) << 8];
+        unmap_watched();
+    }
+}
+
+void MMU::clear_video_dirty() {
+    video_changed = false;
+    std::fill(write_map.begin() + 0x80, write_map.begin() + 0xA0, nullptr);
+}
+
+void MMU::load_boot_rom(std::string filepath) {
+    std::ifstream ifd(filepath, std::ios::binary);
+    if (!ifd.read((char *)boot_rom.data(), boot_rom.size()))
+        throw std::runtime_error(filepath + " is not a 256 byte boot rom");
+    has_boot_rom = true;
+    if (gameboy)
+        map_cartridge();
+}
+
+uint8_t MMU::read_slow(int address) {
+    uint8_t value = read_unmapped(address);
+    if (watched[address >> 8] & WATCH_READ) [[unlikely]]
+        gameboy->debugger.watch_hit(address, value, false);
+    return value;
+}
+
+void MMU::write_slow(int address, uint8_t data) {
+    write_unmapped(address, data);
+    if (watched[address >> 8] & WATCH_WRITE) [[unlikely]]
+        gameboy->debugger.watch_hit(address, data, true);
+}
+
+uint8_t MMU::read_unmapped(int address) {
+    if (dma_cycles > 0 && !(address >= 0xFF80 && address < 0xFFFF)) {
+        // the bus belongs to the DMA, only HRAM is left
+        return 0xFF;
     } else if (address < 0x8000) {
-        // 16 KiB ROM Bank 01–NN
-        return this->gameboy->read_cartridge(address);
+        // rom pages are only unmapped for an mmu that isn't attached to a machine, or a watchpoint
+        if (!gameboy)
+            return 0xFF;
+        if (address < 0x100 && has_boot_rom && !memory.io_reg[0x50])
+            return boot_rom[address];
+        return gameboy->cartridge.read(address);
     } else if (address < 0xA000) {
-        // 8 KiB Video RAM (VRAM)
-        return vram.at(address - 0x8000);
+        // VRAM
+        return memory.vram[address - 0x8000];
     } else if (address < 0xC000) {
-        // 8 KiB External RAM
-        return eram.at(address - 0xA000);
-    } else if (address < 0xD000) {
-        // 4 KiB Work RAM (WRAM)
-        return wram1.at(address - 0xC000);
+        // External RAM, the cartridge handles it when it's disabled or isn't plain memory (MBC2, MBC3 clock)
+        Cartridge& cartridge = gameboy->cartridge;
+        if (cartridge.ram_page)
+            return cartridge.ram_page[address - 0xA000];
+        return cartridge.read_ram(address);
     } else if (address < 0xE000) {
-        // 4 KiB Work RAM (WRAM)
-        return wram2.at(address - 0xD000);
+        // WRAM
+        return memory.wram[address - 0xC000];
     } else if (address < 0xFE00) {
         // Echo RAM (mirror of C000–DDFF)
         throw std::runtime_error("use of this area is prohibited: " + std::to_string(address));
     } else if (address < 0xFEA0) {
         // Object attribute memory (OAM)
-        return oam.at(address - 0xFE00);
+        return memory.oam[address - 0xFE00];
     } else if (address < 0xFF00) {
         // Not Usable
         // not sure what GB hardware typically does with this, but some roms request this address
@@ -63,56 +178,163 @@ uint8_t MMU::read(int address) {
     } else if (address < 0xFF80) {
         // I/O Registers
         if (address == 0xFF00)
-            return 0x0F;
-        return io_reg.at(address - 0xFF00);
+            return gameboy->joypad.read();
+        if (address >= 0xFF10 && address < 0xFF40)
+            return gameboy->apu.read(address);
+        if (address == 0xFF41 || address == 0xFF44 || address == 0xFF45)
+            return gameboy->ppu.read(address);
+        return memory.io_reg[address - 0xFF00];
     } else if (address < 0xFFFF) {
-        // High RAM (HRAM)
-        return hram.at(address - 0xFF80);
+        // HRAM
+        return memory.hram[address - 0xFF80];
     } else {
         // Interrupt Enable register (IE)
-        return ie;
+        return memory.ie;
     }
-
-    return -1;
 }
 
-void MMU::write(int address, uint8_t data) {
-    if (address < 0x4000) {
-        // 16 KiB ROM bank 00
-        gameboy->write_cartridge(address, data);
+void MMU::write_unmapped(int address, uint8_t data) {
+    if (dma_cycles > 0 && !(address >= 0xFF80 && address < 0xFFFF)) {
+        return;
     } else if (address < 0x8000) {
-        // 16 KiB ROM Bank 01–NN
-        gameboy->write_cartridge(address, data);
+        // writes to rom talk to the memory bank controller
+        gameboy->cartridge.write(address, data);
+        map_cartridge();
     } else if (address < 0xA000) {
-        // 8 KiB Video RAM (VRAM)
-        vram.at(address - 0x8000) = data;
+        // VRAM, only the first write after a frame was rendered (or to a watched page) comes through here
+        mark_video_dirty();
+        memory.vram[address - 0x8000] = data;
     } else if (address < 0xC000) {
-        // 8 KiB External RAM
-        eram.at(address - 0xA000) = data;
-    } else if (address < 0xD000) {
-        // 4 KiB Work RAM (WRAM)
-        wram1.at(address - 0xC000) = data;
+        // External RAM, the cartridge handles it when it's disabled or isn't plain memory (MBC2, MBC3 clock)
+        Cartridge& cartridge = gameboy->cartridge;
+        if (cartridge.ram_page)
+            cartridge.ram_page[address - 0xA000] = data;
+        else
+            cartridge.write_ram(address, data);
     } else if (address < 0xE000) {
-        // 4 KiB Work RAM (WRAM)
-        wram2.at(address - 0xD000) = data;
+        // WRAM
+        memory.wram[address - 0xC000] = data;
     } else if (address < 0xFE00) {
         // Echo RAM (mirror of C000–DDFF)
         throw std::runtime_error("use of this area is prohibited: " + std::to_string(address));
     } else if (address < 0xFEA0) {
         // Object attribute memory (OAM)
-        oam.at(address - 0xFE00) = data;
+        int offset = address - 0xFE00;
+        if ((offset & 3) == 0 && gameboy)
+            gameboy->object_lines.move(offset >> 2, memory.oam[offset], data);
+        memory.oam[offset] = data;
+        mark_video_dirty();
     } else if (address < 0xFF00) {
         // Not Usable
         // not sure what GB hardware typically does with this, but some roms request this address
         return;
     } else if (address < 0xFF80) {
         // I/O Registers
-        io_reg.at(address - 0xFF00) = data;
+        if (address == 0xFF00) {
+            gameboy->joypad.write(data);
+            return;
+        }
+        if (address == 0xFF02 && (data & 0x81) == 0x81) {
+            // serial transfer with the internal clock: there is never anything on the other end
+            // of the cable, so the transfer completes immediately and shifts in 0xFF
+            if (gameboy->serial_output.size() < MAX_SERIAL_OUTPUT)
+                gameboy->serial_output.push_back(memory.io_reg[0x01]);
+            memory.io_reg[0x01] = 0xFF;
+            memory.io_reg[0x02] = data & 0x7F;
+            request_interrupt(SERIAL_INTERRUPT_BIT);
+            return;
+        }
+        if (address >= 0xFF10 && address < 0xFF40) {
+            gameboy->apu.write(address, data);
+            return;
+        }
+        if (address == 0xFF41 || address == 0xFF44 || address == 0xFF45) {
+            gameboy->ppu.write(address, data);
+            return;
+        }
+        uint8_t old = memory.io_reg[address - 0xFF00];
+        memory.io_reg[address - 0xFF00] = data;
+        if (address >= 0xFF40 && address < 0xFF4C && ((VIDEO_REGISTERS >> (address - 0xFF40)) & 1) && old != data)
+            mark_video_dirty();
+        if (address == 0xFF40)
+            gameboy->ppu.set_enabled(data & LCDC_ENABLE);
+        if (address == 0xFF40 && ((old ^ data) & LCDC_OBJ_SIZE)) {
+            rebuild_object_lines();
+            return;
+        }
+        if (address == 0xFF46) {
+            start_dma(data);
+            return;
+        }
+        if (address == 0xFF0F)
+            update_interrupts();
+        else if (address == 0xFF50)
+            map_cartridge();
     } else if (address < 0xFFFF) {
-        // High RAM (HRAM)
-        hram.at(address - 0xFF80) = data;
+        // HRAM
+        memory.hram[address - 0xFF80] = data;
     } else {
         // Interrupt Enable register (IE)
-        ie = data;
+        memory.ie = data;
+        update_interrupts();
     }
 }
+
+void MMU::request_interrupt(int bit) {
+    memory.io_reg[0x0F] |= bit;
+    update_interrupts();
+}
+
+void MMU::acknowledge_interrupt(int bit) {
+    memory.io_reg[0x0F] &= ~bit;
+    update_interrupts();
+}
+
+void MMU::start_dma(uint8_t page) {
+    // sources above 0xDF00 see the echo of work ram
+    if (page >= 0xE0)
+        page -= 0x20;
+    // games do this every frame, so copy the whole table in one go when the page is plain memory
+    std::array<uint8_t, sizeof(memory.oam)> copy;
+    const uint8_t* source = read_map[page];
+    if (!source) {
+        for (int i = 0; i < (int)copy.size(); i++)
+            copy[i] = read_slow((page << 8) | i);
+        source = copy.data();
+    }
+    dma_cycles = DMA_CYCLES;
+    map_memory();
+    // mostly the same shadow table as last frame, which leaves the screen as it was
+    if (std::memcmp(memory.oam, source, sizeof(memory.oam)) == 0)
+        return;
+    std::memcpy(memory.oam, source, sizeof(memory.oam));
+    mark_video_dirty();
+    rebuild_object_lines();
+}
+
+void MMU::rebuild_object_lines() {
+    if (gameboy)
+        gameboy->object_lines.rebuild(memory.oam, memory.io_reg[0x40] & LCDC_OBJ_SIZE);
+}
+
+void MMU::tick_dma(int cycles) {
+    dma_cycles -= cycles;
+    if (dma_cycles <= 0) {
+        dma_cycles = 0;
+        map_memory();
+    }
+}
+
+void MMU::save_state(StateWriter& state) {
+    state.write(memory);
+    state.write(dma_cycles);
+}
+
+void MMU::load_state(StateReader& state) {
+    state.read(memory);
+    state.read(dma_cycles);
+    video_changed = true;
+    update_interrupts();
+    map_memory();
+    rebuild_object_lines();
+}
@@ -1,23 +1,122 @@
+#pragma once
+
 #include <array>
 #include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "instruction.h"
+
+#ifdef GB_MEMSTATS
+#include "memstats.h"
+#endif
 
 class Gameboy;
+class StateWriter;
+class StateReader;
+
+// All the ram the MMU owns, at fixed offsets in one cache line aligned block.
+// Trivially copyable, so snapshotting it is a single memcpy.
+struct alignas(64) MemoryArena {
+    uint8_t vram[0x2000];
+    uint8_t wram[0x2000];
+    uint8_t oam[0xA0];
+    uint8_t io_reg[0x80];
+    uint8_t hram[0x7F];
+    uint8_t ie;
+};
+static_assert(std::is_trivially_copyable_v<MemoryArena>);
+
+// MMU::set_watched bits, per page
+const uint8_t WATCH_READ = 1;
+const uint8_t WATCH_WRITE = 2;
+
 class MMU {
  private:
-    std::vector<uint8_t> vram;
-    std::vector<uint8_t> eram;
-    std::vector<uint8_t> wram1;
-    std::vector<uint8_t> wram2;
-    std::vector<uint8_t> oam;
-    std::vector<uint8_t> not_usable;
-    std::vector<uint8_t> io_reg;
-    std::vector<uint8_t> hram;
-    uint8_t ie;
-    std::vector<uint8_t> boot_rom;
+    // IE & IF, refreshed whenever either changes so the cpu can check for
+    // interrupts before every instruction with a single load
+    uint8_t pending_interrupts;
+
+    // One entry per 256 byte page pointing at the memory behind it, so a
+    // normal read or write is a table lookup with no range checks. Null where
+    // the access needs read_slow/write_slow: I/O, OAM, echo ram, rom writes
+    // (bank switching) and external ram the cartridge has to handle itself.
+    // Page 0 points at the boot rom until 0xFF50 is written.
+    std::array<const uint8_t*, 256> read_map;
+    std::array<uint8_t*, 256> write_map;
+    // the same for the cartridge's decoded rom code (see DecodeCache), null where
+    // instructions have to be read through read_map: no cache, boot rom, DMA
+    std::array<const Instruction*, 0x80> code_map;
+
+    // pages with a debugger watchpoint, left out of the tables above so their
+    // accesses come through read_slow/write_slow
+    std::array<uint8_t, 256> watched;
+    bool watching;
+
+    uint8_t read_slow(int address);
+    void write_slow(int address, uint8_t data);
+    // every address, whether it's in the page table or not
+    uint8_t read_unmapped(int address);
+    void write_unmapped(int address, uint8_t data);
+    // fills the page table, or empties it while a DMA blocks the bus
+    void map_memory();
+    void unmap_watched();
+    void start_dma(uint8_t page);
+    // after OAM or the object size changed wholesale
+    void rebuild_object_lines();
+    void update_interrupts() { pending_interrupts = memory.ie & memory.io_reg[0x0F] & 0x1F; }
+
+    MemoryArena memory;
+    std::array<uint8_t, 0x100> boot_rom;
+    bool has_boot_rom;
+    // cycles left of a running OAM DMA, until then the cpu can only reach HRAM
+    int dma_cycles;
+    // something the renderer reads changed since clear_video_dirty(). While it's
+    // false the vram pages are left out of write_map, so only the first write to
+    // vram after a frame takes the slow path
+    bool video_changed;
  public:
     MMU();
+    MMU(const MMU&) = delete;
+    MMU& operator=(const MMU&) = delete;
     Gameboy* gameboy;
-    uint8_t read(int address);
-    void write(int address, uint8_t data);
+    // defined in gameboy-emu.h, where the cartridge type is complete
+    inline uint8_t read(int address);
+    inline void write(int address, uint8_t data);
     void load_boot_rom(std::string filepath);
+    // points the rom, external ram and boot rom pages at what the cartridge currently maps
+    void map_cartridge();
+    // sets the bit in IF (0xFF0F)
+    void request_interrupt(int bit);
+    // clears the bit in IF once the cpu has jumped to its handler
+    void acknowledge_interrupt(int bit);
+    // the instruction at address decoded ahead of time, null (or length 0) when it
+    // has to be fetched byte by byte
+    const Instruction* decoded(int address) const {
+        const Instruction* page = address < 0x8000 ? code_map[address >> 8] : nullptr;
+        return page ? &page[address & 0xFF] : nullptr;
+    }
+    // interrupts that are both enabled and requested, one bit per source
+    uint8_t interrupts_pending() const { return pending_interrupts; }
+
+    bool dma_active() const { return dma_cycles > 0; }
+    // only called while a DMA is running
+    void tick_dma(int cycles);
+    // true when vram, OAM or a register the renderer uses (LCDC, scroll, window, palettes)
+    // was written since the last clear_video_dirty(), otherwise the last frame is still right
+    bool video_dirty() const { return video_changed; }
+    void clear_video_dirty();
+    // forces the next frame to be rendered
+    void mark_video_dirty();
+    // WATCH_READ/WATCH_WRITE for each page, accesses to those pages call Debugger::watch_hit
+    void set_watched(const std::array<uint8_t, 256>& pages);
+    // the ppu has its own bus to vram and oam, so it reads them directly and a DMA doesn't get in its way
+    const MemoryArena& arena() const { return memory; }
+
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
+
+#ifdef GB_MEMSTATS
+    MemStats memstats;
+#endif
 };
@@ -0,0 +1,129 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "movie.h"
+
+const char MOVIE_MAGIC[4] = {'G', 'B', 'M', 'V'};
+const uint8_t MOVIE_VERSION = 1;
+const uint8_t MOVIE_HAS_STATE = 1 << 0;
+// up front room for an hour of frames, the header's frame count isn't trusted before the runs are read
+const size_t MOVIE_RESERVE_FRAMES = 60 * 60 * 60;
+
+static void put_le(std::vector<uint8_t>& out, uint64_t val, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        out.push_back((val >> (8 * i)) & 0xFF);
+}
+
+static uint64_t get_le(const std::vector<uint8_t>& in, size_t& pos, int bytes) {
+    if (pos + bytes > in.size())
+        throw std::runtime_error("movie file is truncated");
+    uint64_t val = 0;
+    for (int i = 0; i < bytes; i++)
+        val |= (uint64_t)in[pos + i] << (8 * i);
+    pos += bytes;
+    return val;
+}
+
+Movie::Movie() {
+    rom_hash = 0;
+}
+
+bool Movie::save(std::string filepath) {
+    std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + 4);
+    out.push_back(MOVIE_VERSION);
+    out.push_back(start_state.empty() ? 0 : MOVIE_HAS_STATE);
+    put_le(out, 0, 2);
+    put_le(out, rom_hash, 8);
+    put_le(out, inputs.size(), 4);
+    put_le(out, start_state.size(), 4);
+    out.insert(out.end(), start_state.begin(), start_state.end());
+
+    // inputs rarely change frame to frame, so runs compress them to almost nothing
+    size_t i = 0;
+    while (i < inputs.size()) {
+        size_t run = 1;
+        while (i + run < inputs.size() && inputs[i + run] == inputs[i])
+            run++;
+        // LEB128 varint
+        size_t n = run;
+        do {
+            uint8_t byte = n & 0x7F;
+            n >>= 7;
+            out.push_back(byte | (n ? 0x80 : 0));
+        } while (n);
+        out.push_back(inputs[i]);
+        i += run;
+    }
+
+    std::ofstream ofd(filepath, std::ios::binary);
+    ofd.write((char *)out.data(), out.size());
+    if (!ofd) {
+        fprintf(stderr, "could not write movie %s\n", filepath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Movie::load(std::string filepath) {
+    std::ifstream ifd(filepath, std::ios::binary);
+    if (!ifd) {
+        fprintf(stderr, "could not open movie %s\n", filepath.c_str());
+        return false;
+    }
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(ifd)), std::istreambuf_iterator<char>());
+
+    try {
+        size_t pos = 0;
+        if (in.size() < 4 || !std::equal(MOVIE_MAGIC, MOVIE_MAGIC + 4, in.begin()))
+            throw std::runtime_error("not a movie file");
+        pos = 4;
+        if (get_le(in, pos, 1) != MOVIE_VERSION)
+            throw std::runtime_error("unsupported movie version");
+        uint8_t flags = get_le(in, pos, 1);
+        get_le(in, pos, 2);
+        rom_hash = get_le(in, pos, 8);
+        uint32_t frames = get_le(in, pos, 4);
+        uint32_t state_size = get_le(in, pos, 4);
+        if (pos + state_size > in.size())
+            throw std::runtime_error("movie file is truncated");
+        start_state.assign(in.begin() + pos, in.begin() + pos + state_size);
+        pos += state_size;
+        if ((flags & MOVIE_HAS_STATE) != !start_state.empty())
+            throw std::runtime_error("movie start state flag does not match its size");
+
+        inputs.clear();
+        inputs.reserve(std::min<size_t>(frames, MOVIE_RESERVE_FRAMES));
+        while (inputs.size() < frames) {
+            size_t run = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                // a run never needs more than 64 bits, anything longer is a corrupt file
+                if (shift >= 64)
+                    throw std::runtime_error("movie input run length is too long");
+                byte = get_le(in, pos, 1);
+                // only bit 0 of the 10th byte still fits, don't quietly drop the others
+                if (shift == 63 && (byte & 0x7E))
+                    throw std::runtime_error("movie input run length is too long");
+                run |= (size_t)(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            uint8_t mask = get_le(in, pos, 1);
+            // inputs.size() <= frames here, so this can't wrap like inputs.size() + run could
+            if (run > frames - inputs.size())
+                throw std::runtime_error("movie input runs exceed the frame count");
+            inputs.insert(inputs.end(), run, mask);
+        }
+    } catch (const std::exception& e) {
+        // bad_alloc and length_error included, a corrupt file shouldn't take the process down
+        fprintf(stderr, "%s: %s\n", filepath.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
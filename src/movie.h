@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Input movie: one joypad mask per frame, replayed from power-on or from an
+// embedded save state.
+//
+// File layout (little endian):
+//   "GBMV"           magic
+//   u8               version
+//   u8               flags, bit 0 = has start state
+//   u16              reserved
+//   u64              rom hash (hash64 of the whole ROM)
+//   u32              frame count
+//   u32              start state size (0 if none)
+//   ...              start state bytes
+//   (varint, u8)*    run-length encoded inputs: run length, then the mask
+class Movie {
+ public:
+    Movie();
+
+    uint64_t rom_hash;
+    std::vector<uint8_t> start_state;
+    std::vector<uint8_t> inputs;
+
+    bool save(std::string filepath);
+    bool load(std::string filepath);
+};
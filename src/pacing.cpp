@@ -0,0 +1,107 @@
+#include <csignal>
+#include <cstdio>
+#include <string>
+
+#include "pacing.h"
+
+const int64_t OVERSLEEP_THRESHOLD_NS = 1000000;
+
+PacingTelemetry::PacingTelemetry(uint64_t target_frame_ns) : target_frame_ns(target_frame_ns) {
+    frames = 0;
+    late_frames = 0;
+    overslept_frames = 0;
+}
+
+void PacingTelemetry::record(uint64_t emulate_ns, uint64_t render_ns, uint64_t present_ns, uint64_t sleep_ns,
+                             uint64_t frame_ns, int64_t oversleep_ns) {
+    frames++;
+    emulate.record(emulate_ns);
+    render.record(render_ns);
+    present.record(present_ns);
+    sleep.record(sleep_ns);
+    frame.record(frame_ns);
+    jitter.record(frame_ns > target_frame_ns ? frame_ns - target_frame_ns : target_frame_ns - frame_ns);
+
+    if (emulate_ns + render_ns + present_ns > target_frame_ns)
+        late_frames++;
+    if (oversleep_ns >= 0) {
+        oversleep.record(oversleep_ns);
+        if (oversleep_ns > OVERSLEEP_THRESHOLD_NS)
+            overslept_frames++;
+    }
+}
+
+bool PacingTelemetry::write_report(std::string filepath) const {
+    FILE* f = fopen(filepath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return false;
+    }
+    bool csv = filepath.size() >= 4 && filepath.compare(filepath.size() - 4, 4, ".csv") == 0;
+    bool ok = csv ? write_csv(f) : write_json(f);
+    fclose(f);
+    return ok;
+}
+
+struct NamedHistogram {
+    const char* name;
+    const Histogram* histogram;
+};
+
+bool PacingTelemetry::write_json(FILE* f) const {
+    auto ull = [](uint64_t v) { return (unsigned long long)v; };
+    NamedHistogram phases[] = {
+        {"emulate", &emulate}, {"render", &render}, {"present", &present}, {"sleep", &sleep},
+        {"frame", &frame}, {"jitter", &jitter}, {"oversleep", &oversleep},
+    };
+
+    fprintf(f, "{\n  \"frames\": %llu,\n  \"target_frame_ns\": %llu,\n", ull(frames), ull(target_frame_ns));
+    fprintf(f, "  \"late_frames\": %llu,\n  \"overslept_frames\": %llu,\n", ull(late_frames), ull(overslept_frames));
+    fprintf(f, "  \"phases\": {");
+    bool first = true;
+    for (const NamedHistogram& phase : phases) {
+        const Histogram& h = *phase.histogram;
+        fprintf(f, "%s\n    \"%s\": {\"count\": %llu, \"min_ns\": %llu, \"mean_ns\": %llu, \"p50_ns\": %llu, "
+                "\"p95_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}",
+                first ? "" : ",", phase.name, ull(h.count), ull(h.count ? h.min : 0), ull(h.mean()),
+                ull(h.percentile(0.50)), ull(h.percentile(0.95)), ull(h.percentile(0.99)), ull(h.max));
+        first = false;
+    }
+    fprintf(f, "\n  }\n}\n");
+    return true;
+}
+
+bool PacingTelemetry::write_csv(FILE* f) const {
+    auto ull = [](uint64_t v) { return (unsigned long long)v; };
+    NamedHistogram phases[] = {
+        {"emulate", &emulate}, {"render", &render}, {"present", &present}, {"sleep", &sleep},
+        {"frame", &frame}, {"jitter", &jitter}, {"oversleep", &oversleep},
+    };
+
+    fprintf(f, "metric,count,min_ns,mean_ns,p50_ns,p95_ns,p99_ns,max_ns\n");
+    for (const NamedHistogram& phase : phases) {
+        const Histogram& h = *phase.histogram;
+        fprintf(f, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", phase.name, ull(h.count), ull(h.count ? h.min : 0),
+                ull(h.mean()), ull(h.percentile(0.50)), ull(h.percentile(0.95)), ull(h.percentile(0.99)), ull(h.max));
+    }
+    fprintf(f, "late_frames,%llu,,,,,,\n", ull(late_frames));
+    fprintf(f, "overslept_frames,%llu,,,,,,\n", ull(overslept_frames));
+    return true;
+}
+
+static volatile std::sig_atomic_t report_requested = 0;
+
+static void handle_report_signal(int) {
+    report_requested = 1;
+}
+
+void install_pacing_signal_handler() {
+    std::signal(SIGUSR1, handle_report_signal);
+}
+
+bool pacing_report_requested() {
+    if (!report_requested)
+        return false;
+    report_requested = 0;
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "histogram.h"
+
+// Frame pacing telemetry: per-phase duration histograms plus counters for
+// frames that blew their budget or woke up late. Everything is recorded and
+// exported from the emulation thread; signal handlers only set a flag.
+class PacingTelemetry {
+ public:
+    PacingTelemetry(uint64_t target_frame_ns);
+
+    // oversleep_ns is how long after the deadline sleep actually returned, -1 when not sleeping to a deadline
+    void record(uint64_t emulate_ns, uint64_t render_ns, uint64_t present_ns, uint64_t sleep_ns,
+                uint64_t frame_ns, int64_t oversleep_ns);
+
+    // picks CSV or JSON from the file extension
+    bool write_report(std::string filepath) const;
+
+    uint64_t target_frame_ns;
+    uint64_t frames;
+    // emulate + render + present alone took longer than a frame
+    uint64_t late_frames;
+    // sleep returned more than OVERSLEEP_THRESHOLD_NS after its deadline
+    uint64_t overslept_frames;
+
+    Histogram emulate;
+    Histogram render;
+    Histogram present;
+    Histogram sleep;
+    Histogram frame;
+    // |frame - target|
+    Histogram jitter;
+    Histogram oversleep;
+
+ private:
+    bool write_json(FILE* f) const;
+    bool write_csv(FILE* f) const;
+};
+
+// installs a SIGUSR1 handler, pacing_report_requested() then returns true once per signal
+void install_pacing_signal_handler();
+bool pacing_report_requested();
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "png.h"
+
+static uint32_t crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+static void put_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    put_u32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_u32(out, crc32(&out[start], out.size() - start));
+}
+
+bool write_png(const std::string& path, const std::vector<uint8_t>& bgra, int width, int height) {
+    // scanlines with a 0 (no filter) byte in front of each
+    std::vector<uint8_t> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        for (int x = 0; x < width; x++) {
+            const uint8_t* p = &bgra[4 * (y * width + x)];
+            raw.push_back(p[2]);
+            raw.push_back(p[1]);
+            raw.push_back(p[0]);
+        }
+    }
+
+    // zlib stream made of stored deflate blocks
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    for (size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535) {
+        size_t len = std::min<size_t>(65535, raw.size() - pos);
+        zlib.push_back(pos + len == raw.size() ? 1 : 0);
+        zlib.push_back(len & 0xFF);
+        zlib.push_back(len >> 8);
+        zlib.push_back(~len & 0xFF);
+        zlib.push_back((~len >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    put_u32(header, width);
+    put_u32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit, truecolor, no interlace
+
+    std::vector<uint8_t> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    put_chunk(out, "IHDR", header);
+    put_chunk(out, "IDAT", zlib);
+    put_chunk(out, "IEND", {});
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes a framebuffer in the renderer's BGRA byte order as an RGB PNG.
+// The image data is stored uncompressed, which is fine for 160x144 debug dumps
+// and avoids depending on zlib.
+bool write_png(const std::string& path, const std::vector<uint8_t>& bgra, int width, int height);
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gameboy-emu.h"
+#include "mmu.h"
+#include "ppu.h"
+#include "state.h"
+#include "tile_decode.h"
+
+const int LINE_CYCLES = 456;
+const int OAM_SCAN_CYCLES = 80;
+const int DRAW_CYCLES = 172;
+const int VBLANK_LINE = 144;
+const int LAST_LINE = 153;
+
+const uint8_t MODE_HBLANK = 0;
+const uint8_t MODE_VBLANK = 1;
+const uint8_t MODE_OAM_SCAN = 2;
+const uint8_t MODE_DRAWING = 3;
+
+const int VBLANK_INTERRUPT_BIT = 1 << 0;
+const int STAT_INTERRUPT_BIT = 1 << 1;
+// STAT bits 3-5 enable the interrupt for modes 0-2, bit 6 for LY == LYC
+const uint8_t STAT_SOURCES = 0x78;
+const uint8_t STAT_LYC_SOURCE = 1 << 6;
+const uint8_t STAT_COINCIDENCE = 1 << 2;
+
+ObjectLines::ObjectLines() {
+    tall = false;
+    lines.fill(0);
+}
+
+void ObjectLines::rebuild(const uint8_t* oam, bool tall) {
+    this->tall = tall;
+    lines.fill(0);
+    for (int index = 0; index < OAM_OBJECTS; index++)
+        set(index, oam[4 * index], true);
+}
+
+void ObjectLines::move(int index, uint8_t old_y, uint8_t new_y) {
+    set(index, old_y, false);
+    set(index, new_y, true);
+}
+
+void ObjectLines::set(int index, uint8_t y, bool on) {
+    // the Y byte is the object's top line + 16, so 0 and 160+ are off screen
+    int top = y - 16;
+    int first = std::max(top, 0);
+    int last = std::min(top + (tall ? 16 : 8), GAMEBOY_DISPLAY_HEIGHT);
+    uint64_t bit = uint64_t(1) << index;
+    for (int line = first; line < last; line++) {
+        if (on)
+            lines[line] |= bit;
+        else
+            lines[line] &= ~bit;
+    }
+}
+
+PPU::PPU() {
+    gameboy = nullptr;
+    // frames run from the start of one vblank to the next, so the renderer at the end of
+    // run_frame sees the finished picture. Power on lands right at the first one
+    enabled = true;
+    mode = MODE_VBLANK;
+    ly = VBLANK_LINE;
+    lyc = 0;
+    stat = 0;
+    stat_line = false;
+    line_cycles = 0;
+    next_event = LINE_CYCLES;
+    line_count = 0;
+}
+
+bool PPU::step() {
+    bool vblank = false;
+    while (line_cycles >= next_event) {
+        if (!enabled) {
+            // nothing happens with the lcd off, the counter just wraps
+            line_cycles -= LINE_CYCLES;
+            line_count++;
+            continue;
+        }
+        if (mode == MODE_OAM_SCAN) {
+            set_mode(MODE_DRAWING);
+            next_event = OAM_SCAN_CYCLES + DRAW_CYCLES;
+            continue;
+        }
+        if (mode == MODE_DRAWING) {
+            set_mode(MODE_HBLANK);
+            next_event = LINE_CYCLES;
+            continue;
+        }
+
+        // end of the line, hblank or vblank
+        line_cycles -= LINE_CYCLES;
+        line_count++;
+        ly = ly == LAST_LINE ? 0 : ly + 1;
+        if (ly < VBLANK_LINE) {
+            mode = MODE_OAM_SCAN;
+            next_event = OAM_SCAN_CYCLES;
+        } else {
+            if (ly == VBLANK_LINE) {
+                mode = MODE_VBLANK;
+                gameboy->mmu.request_interrupt(VBLANK_INTERRUPT_BIT);
+                vblank = true;
+            }
+            next_event = LINE_CYCLES;
+        }
+        update_stat_line();
+    }
+    return vblank;
+}
+
+void PPU::set_mode(uint8_t mode) {
+    this->mode = mode;
+    update_stat_line();
+}
+
+void PPU::update_stat_line() {
+    bool line = false;
+    if (enabled) {
+        line = (ly == lyc && (stat & STAT_LYC_SOURCE)) || (mode != MODE_DRAWING && ((stat >> (3 + mode)) & 1));
+    }
+    // the conditions share one line, so another one coming true while it's already high doesn't fire again
+    if (line && !stat_line)
+        gameboy->mmu.request_interrupt(STAT_INTERRUPT_BIT);
+    stat_line = line;
+}
+
+uint8_t PPU::read(int address) {
+    if (address == 0xFF41) {
+        uint8_t coincidence = ly == lyc ? STAT_COINCIDENCE : 0;
+        return 0x80 | stat | coincidence | mode;
+    }
+    if (address == 0xFF44)
+        return ly;
+    return lyc;
+}
+
+void PPU::write(int address, uint8_t val) {
+    if (address == 0xFF41) {
+        // the mode and coincidence bits are read only
+        stat = val & STAT_SOURCES;
+        update_stat_line();
+    } else if (address == 0xFF45) {
+        lyc = val;
+        update_stat_line();
+    }
+    // LY is read only
+}
+
+void PPU::set_enabled(bool on) {
+    if (on == enabled)
+        return;
+    enabled = on;
+    ly = 0;
+    line_cycles = 0;
+    if (on) {
+        mode = MODE_OAM_SCAN;
+        next_event = OAM_SCAN_CYCLES;
+    } else {
+        mode = MODE_HBLANK;
+        next_event = LINE_CYCLES;
+    }
+    update_stat_line();
+}
+
+void PPU::save_state(StateWriter& state) {
+    state.write(line_cycles);
+    state.write(next_event);
+    state.write(enabled);
+    state.write(mode);
+    state.write(ly);
+    state.write(lyc);
+    state.write(stat);
+    state.write(stat_line);
+}
+
+void PPU::load_state(StateReader& state) {
+    state.read(line_cycles);
+    state.read(next_event);
+    state.read(enabled);
+    state.read(mode);
+    state.read(ly);
+    state.read(lyc);
+    state.read(stat);
+    state.read(stat_line);
+}
+
+static void put_pixel(uint8_t* pixel, uint32_t argb) {
+    std::memcpy(pixel, &argb, 4);
+}
+
+// tiles a span of a line can touch, one more than fit when it isn't tile aligned
+const int MAX_LINE_TILES = GAMEBOY_DISPLAY_WIDTH / 8 + 1;
+
+// draws pixels from..to-1 of a line from a 32x32 tile map, x_origin and y are where on
+// the map pixel 0 of the line is, both wrap around at 256
+static void draw_tiles(uint8_t* row, uint8_t* bg, const MemoryArena& memory, int from, int to, int map_base,
+                       bool unsigned_tiles, int x_origin, int y, const uint32_t* palette) {
+    if (from >= to)
+        return;
+    int tile_map_y = (y & 255) / 8;
+    int y_offset = y & 7;
+    // whole tile rows get decoded, starting with the tile pixel `from` is in
+    int x = (x_origin + from) & 255;
+    int skip = x % 8;
+    int tiles = (skip + to - from + 7) / 8;
+
+    std::array<uint8_t, 2 * MAX_LINE_TILES> planes;
+    for (int t = 0; t < tiles; t++) {
+        int tile_map_x = (x / 8 + t) % 32;
+        uint8_t tile_data_index = memory.vram[map_base + tile_map_y * 32 + tile_map_x - 0x8000];
+
+        // LCDC bit 4 clear: tiles 0-127 at 0x9000, 128-255 at 0x8800
+        int tile_data_pointer;
+        if (unsigned_tiles)
+            tile_data_pointer = 0x8000 + tile_data_index * 16;
+        else
+            tile_data_pointer = 0x9000 + ((int8_t)tile_data_index) * 16;
+
+        planes[2 * t] = memory.vram[tile_data_pointer + 2 * y_offset - 0x8000];
+        planes[2 * t + 1] = memory.vram[tile_data_pointer + 2 * y_offset + 1 - 0x8000];
+    }
+
+    std::array<uint32_t, 8 * MAX_LINE_TILES> argb;
+    std::array<uint8_t, 8 * MAX_LINE_TILES> colors;
+    decode_rows(planes.data(), tiles, palette, argb.data(), colors.data());
+    std::memcpy(row + 4 * from, &argb[skip], 4 * (to - from));
+    std::memcpy(bg + from, &colors[skip], to - from);
+}
+
+// bg holds the background color numbers of the line (before the palette), for objects behind the background
+// palettes are OBP0 and OBP1 as ARGB
+static void draw_objects(uint8_t* row, const uint8_t* bg, const MemoryArena& memory, const ObjectLines& objects, int line,
+                         const uint32_t (*palettes)[4]) {
+    // the first 10 in OAM order are the ones the hardware finds, then the smaller X
+    // wins and OAM order breaks ties, which an insertion sort keeps
+    std::array<int, MAX_OBJECTS_PER_LINE> found;
+    int count = 0;
+    for (uint64_t left = objects.on_line(line); left && count < MAX_OBJECTS_PER_LINE; left &= left - 1) {
+        int index = std::countr_zero(left);
+        int pos = count++;
+        while (pos > 0 && memory.oam[4 * found[pos - 1] + 1] > memory.oam[4 * index + 1]) {
+            found[pos] = found[pos - 1];
+            pos--;
+        }
+        found[pos] = index;
+    }
+    if (count == 0)
+        return;
+
+    int height = objects.tall_objects() ? 16 : 8;
+    // highest priority first, an opaque pixel claims its spot even when it ends up hidden behind the background
+    std::array<bool, GAMEBOY_DISPLAY_WIDTH> taken{};
+    for (int k = 0; k < count; k++) {
+        const uint8_t* object = &memory.oam[4 * found[k]];
+        int top = object[0] - 16;
+        int left = object[1] - 8;
+        int tile = object[2];
+        uint8_t attributes = object[3];
+
+        int y = line - top;
+        if (attributes & 0x40)
+            y = height - 1 - y;
+        if (height == 16)
+            tile &= 0xFE;
+        // objects always use the 0x8000 tile data
+        int lo_bits = memory.vram[tile * 16 + 2 * y];
+        int hi_bits = memory.vram[tile * 16 + 2 * y + 1];
+        const uint32_t* palette = palettes[attributes & 0x10 ? 1 : 0];
+
+        for (int i = 0; i < 8; i++) {
+            int x = left + i;
+            if (x < 0 || x >= GAMEBOY_DISPLAY_WIDTH || taken[x])
+                continue;
+            int bit = attributes & 0x20 ? i : 7 - i;
+            int color = (((hi_bits >> bit) & 1) << 1) | ((lo_bits >> bit) & 1);
+            if (color == 0)
+                continue;
+            taken[x] = true;
+            if ((attributes & 0x80) && bg[x] != 0)
+                continue;
+            put_pixel(&row[4 * x], palette[color]);
+        }
+    }
+}
+
+void render_graphics2(std::vector<uint8_t>& pixels, Gameboy& gameboy) {
+    // draws the background, window and objects for the current frame into pixels (ARGB8888, 160x144), a line at a time
+
+    // straight from vram and the registers, the cpu's view of memory is blocked during OAM DMA
+    const MemoryArena& memory = gameboy.mmu.arena();
+
+    // // sprite addresses
+    // for (int i = 0xFE00; i < 0xFEA0; i++) {
+    //     mmu.write(i, std::rand() % 256);
+    // }
+    // for (int i = 0x8000; i < 0x9000; i++) {
+    //     mmu.write(i, std::rand() % 256);
+    // }
+
+    // // background addresses
+    // for (int i = 0x8000; i < 0x9800; i++) {
+    //     mmu.write(i, std::rand() % 256);
+    // }
+    // for (int i = 0x9800; i < 0xA000; i++) {
+    //     mmu.write(i, std::rand() % 256);
+    // }
+
+
+    // do pixel stuff
+    uint8_t lcdc = memory.io_reg[0x40];
+    int tile_map_base = 0x9800;
+    if (lcdc & (1 << 3))
+        tile_map_base = 0x9C00;
+
+    int window_map_base = 0x9800;
+    if (lcdc & (1 << 6))
+        window_map_base = 0x9C00;
+
+    bool unsigned_tiles = lcdc & (1 << 4);
+
+    uint8_t scy = memory.io_reg[0x42];
+    uint8_t scx = memory.io_reg[0x43];
+    uint8_t wy = memory.io_reg[0x4A];
+    uint8_t wx = memory.io_reg[0x4B];
+
+    uint32_t bg_palette[4];
+    palette_colors(memory.io_reg[0x47], bg_palette);
+    uint32_t object_palettes[2][4];
+    palette_colors(memory.io_reg[0x48], object_palettes[0]);
+    palette_colors(memory.io_reg[0x49], object_palettes[1]);
+
+    // the window has its own line counter, it only advances on lines where the window was drawn
+    int window_line = 0;
+
+    std::array<uint8_t, GAMEBOY_DISPLAY_WIDTH> bg;
+    for (int j = 0; j < GAMEBOY_DISPLAY_HEIGHT; j++) {
+        uint8_t* row = &pixels.at(4 * GAMEBOY_DISPLAY_WIDTH * j);
+
+        if (!(lcdc & (1 << 0))) {
+            // background and window off, the screen shows white under the objects
+            bg.fill(0);
+            for (int i = 0; i < GAMEBOY_DISPLAY_WIDTH; i++)
+                put_pixel(&row[4 * i], 0xFFFFFFFF);
+        } else {
+            // the window replaces the background from WX-7 to the end of the line, so
+            // one sweep draws the background up to there and the window after it
+            bool window = (lcdc & (1 << 5)) && j >= wy && wx <= 166;
+            int window_start = window ? std::max(wx - 7, 0) : GAMEBOY_DISPLAY_WIDTH;
+            draw_tiles(row, bg.data(), memory, 0, window_start, tile_map_base, unsigned_tiles, scx, scy + j, bg_palette);
+            if (window) {
+                draw_tiles(row, bg.data(), memory, window_start, GAMEBOY_DISPLAY_WIDTH, window_map_base,
+                           unsigned_tiles, 7 - wx, window_line, bg_palette);
+                window_line++;
+            }
+        }
+
+        if (lcdc & (1 << 1))
+            draw_objects(row, bg.data(), memory, gameboy.object_lines, j, object_palettes);
+    }
+}
+
+bool render_if_changed(std::vector<uint8_t>& pixels, Gameboy& gameboy) {
+    if (!gameboy.mmu.video_dirty())
+        return false;
+    render_graphics2(pixels, gameboy);
+    gameboy.mmu.clear_video_dirty();
+    return true;
+}
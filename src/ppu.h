@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class Gameboy;
+class StateWriter;
+class StateReader;
+
+const int GAMEBOY_DISPLAY_WIDTH = 160;
+const int GAMEBOY_DISPLAY_HEIGHT = 144;
+const int OAM_OBJECTS = 40;
+const int MAX_OBJECTS_PER_LINE = 10;
+
+// Which objects (sprites) cover each visible line, as a bitmask over the 40
+// OAM entries, so drawing a line doesn't have to scan OAM. The MMU keeps it up
+// to date: a write to an object's Y byte moves just that object, a DMA or a
+// change of object size (LCDC bit 2) rebuilds it. The hardware's limit of 10
+// objects per line is the 10 lowest set bits.
+class ObjectLines {
+ public:
+    ObjectLines();
+    void rebuild(const uint8_t* oam, bool tall);
+    void move(int index, uint8_t old_y, uint8_t new_y);
+    uint64_t on_line(int line) const { return lines[line]; }
+    bool tall_objects() const { return tall; }
+
+ private:
+    bool tall;
+    std::array<uint64_t, GAMEBOY_DISPLAY_HEIGHT> lines;
+    void set(int index, uint8_t y, bool on);
+};
+
+// LCD timing and the registers that come with it: STAT (0xFF41), LY (0xFF44)
+// and LYC (0xFF45). Every visible line is OAM scan (mode 2, 80 cycles), drawing
+// (mode 3, 172 cycles) and hblank (mode 0, the rest of the 456), followed by 10
+// lines of vblank (mode 1). The mode changes are events: after each instruction
+// run_frame compares line_cycles against next_event and only calls step() once
+// it's reached, so nothing is polled per cycle. Mode 3 is always 172 cycles, the
+// time objects and fine scrolling add to it isn't modelled.
+class PPU {
+ public:
+    PPU();
+    Gameboy* gameboy;
+    // cycles into the current line, and where in the line the next mode change happens
+    int line_cycles;
+    int next_event;
+    // lines since power on, only for telling lines apart (not part of the save state)
+    uint32_t line_count;
+
+    // handles every mode change up to line_cycles, returns true when vblank started
+    bool step();
+    uint8_t read(int address);
+    void write(int address, uint8_t val);
+    // LCDC bit 7, turning the lcd off stops it at the start of line 0 in mode 0
+    void set_enabled(bool on);
+
+    void save_state(StateWriter& state);
+    void load_state(StateReader& state);
+
+ private:
+    bool enabled;
+    uint8_t mode;
+    uint8_t ly;
+    uint8_t lyc;
+    // STAT bits 3-6, which conditions raise the STAT interrupt
+    uint8_t stat;
+    // the OR of all enabled STAT conditions, the interrupt fires when it goes from false to true
+    bool stat_line;
+
+    void set_mode(uint8_t mode);
+    void update_stat_line();
+};
+
+void render_graphics2(std::vector<uint8_t>& pixels, Gameboy& gameboy);
+// render_graphics2 only if vram, OAM or the video registers changed since the last
+// call, returns false when pixels already hold this frame
+bool render_if_changed(std::vector<uint8_t>& pixels, Gameboy& gameboy);
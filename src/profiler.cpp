@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "profiler.h"
+
+Profiler::Profiler() {
+    base_count.fill(0);
+    base_cycles.fill(0);
+    cb_count.fill(0);
+    cb_cycles.fill(0);
+    sample_countdown = SAMPLE_INTERVAL;
+}
+
+void Profiler::dump_folded(std::string filepath) {
+    FILE* f = fopen(filepath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return;
+    }
+    for (auto [key, count] : pc_samples) {
+        int bank = key >> 16;
+        int pc = key & 0xFFFF;
+        fprintf(f, "bank_%02X;page_%04X;pc_%04X %llu\n", bank, pc & 0xFF00, pc, (unsigned long long)count);
+    }
+    fclose(f);
+}
+
+void Profiler::dump_json(std::string filepath) {
+    FILE* f = fopen(filepath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return;
+    }
+
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    for (int i = 0; i < 256; i++) {
+        instructions += base_count[i] + cb_count[i];
+        cycles += base_cycles[i] + cb_cycles[i];
+    }
+    fprintf(f, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n", (unsigned long long)instructions, (unsigned long long)cycles);
+
+    auto dump_page = [f](const char* name, std::array<uint64_t, 256>& count, std::array<uint64_t, 256>& cyc) {
+        fprintf(f, "  \"%s\": [", name);
+        bool first = true;
+        for (int i = 0; i < 256; i++) {
+            if (count[i] == 0)
+                continue;
+            fprintf(f, "%s\n    {\"opcode\": \"0x%02X\", \"count\": %llu, \"cycles\": %llu}", first ? "" : ",", i,
+                    (unsigned long long)count[i], (unsigned long long)cyc[i]);
+            first = false;
+        }
+        fprintf(f, "\n  ],\n");
+    };
+    dump_page("opcodes", base_count, base_cycles);
+    dump_page("cb_opcodes", cb_count, cb_cycles);
+
+    // hottest first
+    std::vector<std::pair<uint32_t, uint64_t>> samples(pc_samples.begin(), pc_samples.end());
+    std::sort(samples.begin(), samples.end(), [](auto& a, auto& b) { return a.second > b.second; });
+    fprintf(f, "  \"sample_interval\": %d,\n  \"pc_samples\": [", SAMPLE_INTERVAL);
+    for (size_t i = 0; i < samples.size(); i++) {
+        fprintf(f, "%s\n    {\"bank\": %u, \"pc\": \"0x%04X\", \"count\": %llu}", i ? "," : "",
+                samples[i].first >> 16, samples[i].first & 0xFFFF, (unsigned long long)samples[i].second);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+}
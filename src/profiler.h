@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Per-opcode execution counts and a sampled PC histogram. Only compiled in
+// with `make PROFILE=1` (defines GB_PROFILE), otherwise the hooks in
+// CPU::execute are preprocessed away and the release build pays nothing.
+class Profiler {
+ public:
+    // one in every SAMPLE_INTERVAL instructions records its PC
+    static const int SAMPLE_INTERVAL = 64;
+
+    Profiler();
+
+    void record(uint8_t opcode, uint8_t cb_opcode, int cycles, int bank, uint16_t pc) {
+        if (opcode == 0xCB) {
+            cb_count[cb_opcode]++;
+            cb_cycles[cb_opcode] += cycles;
+        } else {
+            base_count[opcode]++;
+            base_cycles[opcode] += cycles;
+        }
+        if (--sample_countdown == 0) {
+            sample_countdown = SAMPLE_INTERVAL;
+            pc_samples[(bank << 16) | pc]++;
+        }
+    }
+
+    // `bank;page;pc count` lines, feed to flamegraph.pl
+    void dump_folded(std::string filepath);
+    void dump_json(std::string filepath);
+
+ private:
+    std::array<uint64_t, 256> base_count;
+    std::array<uint64_t, 256> base_cycles;
+    std::array<uint64_t, 256> cb_count;
+    std::array<uint64_t, 256> cb_cycles;
+    std::unordered_map<uint32_t, uint64_t> pc_samples;
+    int sample_countdown;
+};
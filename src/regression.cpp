@@ -0,0 +1,187 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "headless.h"
+#include "hash.h"
+#include "png.h"
+#include "ppu.h"
+#include "regression.h"
+
+struct RegressionResult {
+    std::string rom;
+    std::string status;
+    std::string message;
+    long frames;
+    // frames where nothing on screen changed, not rendered again
+    long unchanged_frames;
+    double seconds;
+};
+
+static std::string with_extension(const std::string& rom, const std::string& ext) {
+    size_t dot = rom.find_last_of('.');
+    return rom.substr(0, dot) + ext;
+}
+
+static uint8_t button_mask(const std::string& name) {
+    if (name == "right") return BUTTON_RIGHT;
+    if (name == "left") return BUTTON_LEFT;
+    if (name == "up") return BUTTON_UP;
+    if (name == "down") return BUTTON_DOWN;
+    if (name == "a") return BUTTON_A;
+    if (name == "b") return BUTTON_B;
+    if (name == "select") return BUTTON_SELECT;
+    if (name == "start") return BUTTON_START;
+    throw std::runtime_error("unknown button " + name);
+}
+
+// expands an input script into one mask per frame, the last mask holds for the rest of the run
+static std::vector<uint8_t> load_script(const std::string& path) {
+    std::vector<uint8_t> inputs;
+    std::ifstream file(path);
+    if (!file)
+        return inputs;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        long frame;
+        if (!(words >> frame))
+            continue;
+        if (frame < (long)inputs.size())
+            throw std::runtime_error(path + ":" + std::to_string(line_number) + ": frames must increase");
+        uint8_t mask = 0;
+        std::string name;
+        while (words >> name)
+            mask |= button_mask(name);
+        inputs.resize(frame, inputs.empty() ? 0 : inputs.back());
+        inputs.push_back(mask);
+    }
+    return inputs;
+}
+
+static std::vector<uint64_t> load_golden(const std::string& path) {
+    std::vector<uint64_t> hashes;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[0] != '#')
+            hashes.push_back(std::stoull(line, nullptr, 16));
+    }
+    return hashes;
+}
+
+static void save_golden(const std::string& path, const std::vector<uint64_t>& hashes) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+        throw std::runtime_error("could not write " + path);
+    fprintf(f, "# framebuffer hash per frame\n");
+    for (uint64_t hash : hashes)
+        fprintf(f, "%016llx\n", (unsigned long long)hash);
+    fclose(f);
+}
+
+static RegressionResult run_regression_rom(const std::string& rom, const RegressionOptions& options) {
+    RegressionResult result;
+    result.rom = rom;
+    result.frames = 0;
+    result.unchanged_frames = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        std::string golden_path = with_extension(rom, ".golden");
+        std::string png = with_extension(rom, ".mismatch.png");
+        // don't leave the picture from an older failure around
+        std::remove(png.c_str());
+        std::vector<uint64_t> golden;
+        if (!options.update)
+            golden = load_golden(golden_path);
+        std::vector<uint8_t> inputs = load_script(with_extension(rom, ".input"));
+
+        long frames = options.frames;
+        if (frames == 0)
+            frames = golden.empty() ? DEFAULT_REGRESSION_FRAMES : golden.size();
+
+        auto machine = std::make_unique<HeadlessMachine>(rom);
+        std::vector<uint8_t> pixels(GAMEBOY_DISPLAY_WIDTH * GAMEBOY_DISPLAY_HEIGHT * 4, 0);
+        std::vector<uint64_t> hashes;
+        hashes.reserve(frames);
+
+        for (long frame = 0; frame < frames; frame++) {
+            if (!inputs.empty())
+                machine->gameboy.joypad.set_buttons(inputs[std::min<size_t>(frame, inputs.size() - 1)]);
+            machine->run_frame();
+            result.frames++;
+
+            // an unchanged frame has the same hash as the one before
+            uint64_t hash;
+            if (render_if_changed(pixels, machine->gameboy) || hashes.empty()) {
+                hash = hash64(pixels.data(), pixels.size());
+            } else {
+                hash = hashes.back();
+                result.unchanged_frames++;
+            }
+            hashes.push_back(hash);
+            if (!golden.empty() && (frame >= (long)golden.size() || golden[frame] != hash)) {
+                write_png(png, pixels, GAMEBOY_DISPLAY_WIDTH, GAMEBOY_DISPLAY_HEIGHT);
+                result.status = "fail";
+                if (frame >= (long)golden.size())
+                    result.message = "golden file only has " + std::to_string(golden.size()) + " frames";
+                else
+                    result.message = "frame " + std::to_string(frame) + " differs, see " + png;
+                break;
+            }
+        }
+
+        if (result.status.empty() && golden.empty()) {
+            save_golden(golden_path, hashes);
+            result.status = options.update ? "updated" : "new";
+        } else if (result.status.empty()) {
+            result.status = "pass";
+        }
+    } catch (const std::exception& e) {
+        result.status = "error";
+        result.message = e.what();
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int run_regression(const RegressionOptions& options) {
+    std::vector<std::string> roms;
+    try {
+        roms = find_roms(options.directory);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::vector<RegressionResult> results(roms.size());
+    auto start = std::chrono::steady_clock::now();
+    int jobs = run_parallel(roms.size(), options.jobs, [&](size_t index) {
+        results[index] = run_regression_rom(roms[index], options);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    long frames = 0;
+    for (const RegressionResult& r : results) {
+        failed += r.status == "fail" || r.status == "error";
+        frames += r.frames;
+        printf("%-7s %s (%ld frames, %.0f%% unchanged, %.2fs)%s%s\n", r.status.c_str(), r.rom.c_str(), r.frames,
+               r.frames ? 100.0 * r.unchanged_frames / r.frames : 0.0, r.seconds, r.message.empty() ? "" : ": ",
+               r.message.c_str());
+    }
+    printf("%d/%zu failed, %ld frames in %.2fs (%.0f fps) using %d threads\n", failed, results.size(), frames,
+           seconds, frames / seconds, jobs);
+    return failed == 0 ? 0 : 1;
+}
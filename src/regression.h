@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+struct RegressionOptions {
+    std::string directory;
+    int jobs = 0;
+    // 0 = as many frames as the golden file has (or DEFAULT_REGRESSION_FRAMES for new ones)
+    long frames = 0;
+    bool update = false;
+};
+
+const long DEFAULT_REGRESSION_FRAMES = 600;
+
+// Framebuffer regression suite. Every rom under the directory runs headless with
+// the inputs from <name>.input (optional) and the hash of each rendered frame is
+// compared against <name>.golden. Missing golden files (or all of them with
+// update) are written instead. The first mismatching frame is saved as
+// <name>.mismatch.png. Returns 0 if nothing mismatched.
+//
+// .input files hold one "frame button..." line per change, the buttons are held
+// from that frame until the next line, e.g.
+//   120 start
+//   125
+//   300 a right
+int run_regression(const RegressionOptions& options);
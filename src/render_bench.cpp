@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gameboy-emu.h"
+#include "hash.h"
+#include "ppu.h"
+#include "render_bench.h"
+#include "tile_decode.h"
+#include "upscale.h"
+
+struct RenderScene {
+    const char* name;
+    std::function<void(Gameboy&)> setup;
+    // called before every frame, for scenes that change as they go
+    std::function<void(Gameboy&, long)> update;
+};
+
+// random tiles everywhere and a scroll that isn't tile aligned
+static void setup_background(Gameboy& gameboy) {
+    std::mt19937 rng(1);
+    for (int address = 0x8000; address < 0xA000; address++)
+        gameboy.write_mmu(address, rng());
+    gameboy.write_mmu(0xFF47, 0xE4);
+    gameboy.write_mmu(0xFF48, 0xE4);
+    gameboy.write_mmu(0xFF49, 0x1B);
+    gameboy.write_mmu(0xFF42, 5);
+    gameboy.write_mmu(0xFF43, 3);
+    gameboy.write_mmu(0xFF40, 0x91);
+}
+
+// all 40 objects in four bands of ten, so each band's lines are at the per-line limit,
+// with random tiles, flips, palettes and background priority
+static void setup_objects(Gameboy& gameboy, bool tall) {
+    setup_background(gameboy);
+    std::mt19937 rng(2);
+    for (int index = 0; index < OAM_OBJECTS; index++) {
+        int band = index / MAX_OBJECTS_PER_LINE;
+        gameboy.write_mmu(0xFE00 + 4 * index, 16 + 36 * band + (index % 3));
+        gameboy.write_mmu(0xFE01 + 4 * index, 8 + 15 * (index % MAX_OBJECTS_PER_LINE) + (index % 4));
+        gameboy.write_mmu(0xFE02 + 4 * index, rng());
+        gameboy.write_mmu(0xFE03 + 4 * index, rng() & 0xF0);
+    }
+    gameboy.write_mmu(0xFF40, 0x93 | (tall ? 0x04 : 0));
+}
+
+// a window over the lower part of the screen, like a status bar or text box, or over all of it
+static void setup_window(Gameboy& gameboy, int wy, int wx) {
+    setup_background(gameboy);
+    gameboy.write_mmu(0xFF4A, wy);
+    gameboy.write_mmu(0xFF4B, wx);
+    // background from 0x9800, window from 0x9C00
+    gameboy.write_mmu(0xFF40, 0xF1);
+}
+
+int run_render_bench(long frames) {
+    std::vector<RenderScene> scenes = {
+        {"background", setup_background, nullptr},
+        {"objects 8x8", [](Gameboy& gameboy) { setup_objects(gameboy, false); }, nullptr},
+        {"objects 8x16", [](Gameboy& gameboy) { setup_objects(gameboy, true); }, nullptr},
+        {"window bottom", [](Gameboy& gameboy) { setup_window(gameboy, 96, 7); }, nullptr},
+        {"window full", [](Gameboy& gameboy) { setup_window(gameboy, 0, 7); }, nullptr},
+        {"window split", [](Gameboy& gameboy) { setup_window(gameboy, 0, 87); }, nullptr},
+        {"window objects", [](Gameboy& gameboy) {
+             setup_objects(gameboy, false);
+             setup_window(gameboy, 48, 47);
+             gameboy.write_mmu(0xFF40, 0xF3);
+         }, nullptr},
+        // every object's Y changes every frame, what the line lists cost to keep up to date
+        {"objects moving", [](Gameboy& gameboy) { setup_objects(gameboy, false); },
+         [](Gameboy& gameboy, long frame) {
+             for (int index = 0; index < OAM_OBJECTS; index++)
+                 gameboy.write_mmu(0xFE00 + 4 * index, 16 + (frame + 3 * index) % 144);
+         }},
+    };
+
+    printf("%ld frames per scene\n", frames);
+    std::vector<uint8_t> pixels(GAMEBOY_DISPLAY_WIDTH * GAMEBOY_DISPLAY_HEIGHT * 4, 0);
+
+    // untimed, otherwise the first scene also pays for the cpu clocking up
+    auto warmup = std::make_unique<Gameboy>();
+    setup_background(*warmup);
+    for (long frame = 0; frame < frames; frame++)
+        render_graphics2(pixels, *warmup);
+
+    double baseline = 0;
+    for (const RenderScene& scene : scenes) {
+        auto gameboy = std::make_unique<Gameboy>();
+        scene.setup(*gameboy);
+
+        auto start = std::chrono::steady_clock::now();
+        for (long frame = 0; frame < frames; frame++) {
+            if (scene.update)
+                scene.update(*gameboy, frame);
+            render_graphics2(pixels, *gameboy);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double us = seconds * 1e6 / frames;
+        if (baseline == 0)
+            baseline = us;
+        printf("%-16s %8.2f us/frame %6.2fx  (last frame %016llx)\n", scene.name, us, us / baseline,
+               (unsigned long long)hash64(pixels.data(), pixels.size()));
+    }
+    return 0;
+}
+
+const DecodeKernel DECODE_KERNELS[] = {DecodeKernel::scalar, DecodeKernel::sse2, DecodeKernel::avx2};
+
+int run_decode_bench(long lines) {
+    DecodeRows scalar = decode_rows_kernel(DecodeKernel::scalar);
+    printf("renderer uses %s\n", decode_kernel_name(best_decode_kernel()));
+
+    // every lo/hi combination at once, then all 256 palettes
+    std::vector<uint8_t> planes(2 * 0x10000);
+    for (int row = 0; row < 0x10000; row++) {
+        planes[2 * row] = row & 0xFF;
+        planes[2 * row + 1] = row >> 8;
+    }
+    std::vector<uint32_t> expected_argb(8 * 0x10000), argb(8 * 0x10000);
+    std::vector<uint8_t> expected_colors(8 * 0x10000), colors(8 * 0x10000);
+
+    int failed = 0;
+    for (DecodeKernel kernel : DECODE_KERNELS) {
+        DecodeRows rows = decode_rows_kernel(kernel);
+        if (!rows) {
+            printf("%-8s not supported on this cpu\n", decode_kernel_name(kernel));
+            continue;
+        }
+
+        long mismatches = 0;
+        for (int bgp = 0; bgp < 256; bgp++) {
+            uint32_t palette[4];
+            palette_colors(bgp, palette);
+            scalar(planes.data(), 0x10000, palette, expected_argb.data(), expected_colors.data());
+            rows(planes.data(), 0x10000, palette, argb.data(), colors.data());
+            if (argb != expected_argb || colors != expected_colors)
+                mismatches++;
+        }
+
+        // a background line is 21 tile rows
+        std::mt19937 rng(3);
+        std::vector<uint8_t> line(2 * 21);
+        for (uint8_t& byte : line)
+            byte = rng();
+        uint32_t palette[4];
+        palette_colors(0xE4, palette);
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < lines; i++) {
+            line[i % line.size()] ^= i;
+            rows(line.data(), 21, palette, argb.data(), colors.data());
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-8s %7.2f ns/line %7.0f Mpixels/s  %s\n", decode_kernel_name(kernel), seconds * 1e9 / lines,
+               lines * 168 / seconds / 1e6, mismatches ? "MISMATCH" : "matches scalar for all rows and palettes");
+        if (mismatches)
+            failed = 1;
+    }
+    return failed;
+}
+
+int run_scale_bench(long frames) {
+    // a real frame (flat areas and edges, where scale2x and lcd have work to do) and noise
+    auto gameboy = std::make_unique<Gameboy>();
+    setup_objects(*gameboy, false);
+    std::vector<uint8_t> pixels(GAMEBOY_DISPLAY_WIDTH * GAMEBOY_DISPLAY_HEIGHT * 4, 0);
+    render_graphics2(pixels, *gameboy);
+    std::vector<uint32_t> scene(GAMEBOY_DISPLAY_WIDTH * GAMEBOY_DISPLAY_HEIGHT);
+    std::memcpy(scene.data(), pixels.data(), pixels.size());
+    std::vector<uint32_t> noise(scene.size());
+    std::mt19937 rng(4);
+    for (uint32_t& pixel : noise)
+        pixel = 0xFF000000 | (rng() % 4) * 0x555555;
+
+    printf("%ld frames per filter and scale\n", frames);
+    int failed = 0;
+    std::vector<uint32_t> out(scene.size() * MAX_SCALE * MAX_SCALE), expected(out.size());
+    for (ScaleFilter filter : {ScaleFilter::nearest, ScaleFilter::scale2x, ScaleFilter::lcd}) {
+        for (int scale = 2; scale <= MAX_SCALE; scale++) {
+            if (!scale_supported(filter, scale))
+                continue;
+
+            bool matches = true;
+            for (const std::vector<uint32_t>* src : {&scene, &noise}) {
+                upscale(filter, scale, src->data(), expected.data(), false);
+                upscale(filter, scale, src->data(), out.data(), true);
+                size_t size = src->size() * scale * scale;
+                matches = matches && std::equal(out.begin(), out.begin() + size, expected.begin());
+            }
+            if (!matches)
+                failed = 1;
+
+            double ms[2];
+            for (int simd = 0; simd < 2; simd++) {
+                auto start = std::chrono::steady_clock::now();
+                for (long frame = 0; frame < frames; frame++)
+                    upscale(filter, scale, scene.data(), out.data(), simd);
+                ms[simd] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3 / frames;
+            }
+            printf("%-8s %dx  %6.3f ms/frame (plain loops %6.3f)  %s\n", scale_filter_name(filter), scale, ms[1], ms[0],
+                   matches ? "matches" : "MISMATCH");
+        }
+    }
+    return failed;
+}
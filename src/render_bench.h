@@ -0,0 +1,24 @@
+#pragma once
+
+const long DEFAULT_RENDER_BENCH_FRAMES = 2000;
+
+// Renders a set of synthetic scenes (background only, a full load of objects,
+// windows of different sizes, objects moving every frame, ...) with
+// render_graphics2 and prints the time per frame of each, relative to the
+// background-only one. Needs no rom, the scenes are written straight into vram
+// and OAM of an otherwise empty machine.
+int run_render_bench(long frames);
+
+const long DEFAULT_DECODE_BENCH_LINES = 1000000;
+
+// Checks every tile decode kernel the cpu supports against the scalar one for
+// every possible row and palette (exhaustive, 2^24 cases), then times each on
+// lines worth of random tile rows. Returns 1 if any kernel disagrees.
+int run_decode_bench(long lines);
+
+const long DEFAULT_SCALE_BENCH_FRAMES = 200;
+
+// Checks the SSE2 upscaling kernels against the plain loops for every filter
+// and scale, then prints the milliseconds per frame of each. Returns 1 if any
+// output differs.
+int run_scale_bench(long frames);
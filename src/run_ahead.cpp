@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "gameboy-emu.h"
+#include "apu.h"
+#include "run_ahead.h"
+
+static uint64_t ns_since(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - from).count();
+}
+
+RunAhead::RunAhead(int frames) : frames(frames), count(0), snapshot_ns(0), emulate_ns(0), restore_ns(0),
+                                 serial_size(0) {
+}
+
+int RunAhead::run(Gameboy& gameboy) {
+    auto start = std::chrono::steady_clock::now();
+    // the vector keeps its capacity, so after the first frame this is just copies
+    gameboy.save_state(snapshot);
+    serial_size = gameboy.serial_output.size();
+    snapshot_ns += ns_since(start);
+
+    start = std::chrono::steady_clock::now();
+    gameboy.apu.set_muted(true);
+    gameboy.debugger.set_muted(true);
+    int instructions = 0;
+    for (int i = 0; i < frames; i++) {
+        instructions += gameboy.run_frame();
+        gameboy.apu.end_frame();
+    }
+    gameboy.apu.set_muted(false);
+    gameboy.debugger.set_muted(false);
+    emulate_ns += ns_since(start);
+    count++;
+    return instructions;
+}
+
+void RunAhead::restore(Gameboy& gameboy) {
+    auto start = std::chrono::steady_clock::now();
+    gameboy.load_state(snapshot);
+    gameboy.serial_output.resize(serial_size);
+    restore_ns += ns_since(start);
+}
+
+void RunAhead::print_report(FILE* out) const {
+    if (count == 0)
+        return;
+    fprintf(out, "run-ahead: %d frames, %.3f ms per frame (snapshot %.1f us, emulate %.3f ms, restore %.1f us, "
+            "%zu byte state)\n", frames, (snapshot_ns + emulate_ns + restore_ns) / 1e6 / count,
+            snapshot_ns / 1e3 / count, emulate_ns / 1e6 / count, restore_ns / 1e3 / count, snapshot.size());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class Gameboy;
+
+// Run-ahead hides the game's own input lag: after the real frame the machine
+// is snapshotted, runs `frames` more frames with the same input (silently and
+// without rendering), the last of those is what gets drawn, and then the
+// snapshot is restored. Only real frames are ever kept, so movies, audio and
+// save states are unaffected.
+class RunAhead {
+ public:
+    explicit RunAhead(int frames);
+
+    // call after the real frame's audio has been taken, leaves the machine in the future
+    int run(Gameboy& gameboy);
+    // call after rendering
+    void restore(Gameboy& gameboy);
+
+    int frames;
+
+    // host cost, summed over all calls
+    uint64_t count;
+    uint64_t snapshot_ns;
+    uint64_t emulate_ns;
+    uint64_t restore_ns;
+
+    void print_report(FILE* out) const;
+
+ private:
+    std::vector<uint8_t> snapshot;
+    size_t serial_size;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Minimal binary (de)serializer for save states. Fields are written in
+// declaration order as raw bytes, so a state is only valid for the same
+// build on the same architecture -- fine for movies and run-ahead.
+class StateWriter {
+ public:
+    explicit StateWriter(std::vector<uint8_t>& out) : out(out) {
+    }
+
+    template <typename T>
+    void write(const T& val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        size_t size = out.size();
+        out.resize(size + sizeof(T));
+        std::memcpy(out.data() + size, &val, sizeof(T));
+    }
+
+    void write_bytes(const std::vector<uint8_t>& bytes) {
+        write<uint32_t>(bytes.size());
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+
+ private:
+    std::vector<uint8_t>& out;
+};
+
+class StateReader {
+ public:
+    explicit StateReader(const std::vector<uint8_t>& in) : in(in), pos(0) {
+    }
+
+    template <typename T>
+    void read(T& val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (pos + sizeof(T) > in.size())
+            throw std::runtime_error("save state is truncated");
+        std::memcpy(&val, in.data() + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+
+    void read_bytes(std::vector<uint8_t>& bytes) {
+        uint32_t size;
+        read(size);
+        if (size != bytes.size())
+            throw std::runtime_error("save state does not match this machine");
+        if (pos + size > in.size())
+            throw std::runtime_error("save state is truncated");
+        std::memcpy(bytes.data(), in.data() + pos, size);
+        pos += size;
+    }
+
+ private:
+    const std::vector<uint8_t>& in;
+    size_t pos;
+};
@@ -0,0 +1,183 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ppu.h"
+#include "stats.h"
+
+Stats::Stats() :
+    frames(0), emulated_frames(0), instructions(0), cpu_ns(0), render_ns(0), present_ns(0), sleep_ns(0),
+    frame_ns(0), avg_frame_ns(0), avg_cpu_ns(0), avg_render_ns(0), avg_present_ns(0), avg_sleep_ns(0),
+    avg_emulated_frame_ns(0), last_instructions(0) {
+}
+
+// exponential moving average with weight 1/16 for the new value
+static void smooth(std::atomic<uint64_t>& avg, uint64_t value) {
+    uint64_t old = avg.load(std::memory_order_relaxed);
+    avg.store(old == 0 ? value : old - old / 16 + value / 16, std::memory_order_relaxed);
+}
+
+void Stats::record_frame(uint64_t cpu, uint64_t render, uint64_t present, uint64_t sleep,
+                         uint64_t frame, uint64_t instrs, uint64_t emulated) {
+    // only the emulation thread writes, so load+store is enough (no read-modify-write contention)
+    auto add = [](std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    };
+    add(cpu_ns, cpu);
+    add(render_ns, render);
+    add(present_ns, present);
+    add(sleep_ns, sleep);
+    add(frame_ns, frame);
+    add(instructions, instrs);
+    add(emulated_frames, emulated);
+    smooth(avg_cpu_ns, cpu);
+    smooth(avg_render_ns, render);
+    smooth(avg_present_ns, present);
+    smooth(avg_sleep_ns, sleep);
+    smooth(avg_frame_ns, frame);
+    if (emulated > 0) {
+        smooth(avg_emulated_frame_ns, frame / emulated);
+        last_instructions.store(instrs / emulated, std::memory_order_relaxed);
+    }
+    // published last so a reader that sees the new frame count sees the rest too
+    frames.store(frames.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+StatsWriter::StatsWriter(Stats& stats) : stats(stats), running(false) {
+}
+
+StatsWriter::~StatsWriter() {
+    stop();
+}
+
+bool StatsWriter::start(std::string filepath, int interval_ms) {
+    FILE* f = fopen(filepath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filepath.c_str());
+        return false;
+    }
+    // frames, fps and instructions_per_frame are emulated frames, host_fps and the times are per presented frame
+    fprintf(f, "time_s,frames,fps,host_fps,instructions_per_frame,frame_ms,cpu_ms,render_ms,present_ms,sleep_ms\n");
+    running = true;
+    thread = std::thread(&StatsWriter::loop, this, f, interval_ms);
+    return true;
+}
+
+void StatsWriter::stop() {
+    if (running) {
+        running = false;
+        thread.join();
+    }
+}
+
+void StatsWriter::loop(FILE* f, int interval_ms) {
+    auto begin = std::chrono::steady_clock::now();
+    auto last_time = begin;
+    uint64_t last_frames = 0, last_emulated = 0, last_instrs = 0, last_frame = 0, last_cpu = 0, last_render = 0, last_present = 0, last_sleep = 0;
+
+    while (running) {
+        // sleep in small steps so stop() doesn't have to wait a whole interval
+        auto wake = last_time + std::chrono::milliseconds(interval_ms);
+        while (running && std::chrono::steady_clock::now() < wake)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        auto now = std::chrono::steady_clock::now();
+        uint64_t frames = stats.frames.load(std::memory_order_acquire);
+        uint64_t emulated = stats.emulated_frames.load(std::memory_order_relaxed);
+        uint64_t instrs = stats.instructions.load(std::memory_order_relaxed);
+        uint64_t frame = stats.frame_ns.load(std::memory_order_relaxed);
+        uint64_t cpu = stats.cpu_ns.load(std::memory_order_relaxed);
+        uint64_t render = stats.render_ns.load(std::memory_order_relaxed);
+        uint64_t present = stats.present_ns.load(std::memory_order_relaxed);
+        uint64_t sleep = stats.sleep_ns.load(std::memory_order_relaxed);
+
+        uint64_t n = frames - last_frames;
+        uint64_t emulated_n = emulated - last_emulated;
+        double elapsed = std::chrono::duration<double>(now - last_time).count();
+        double per_frame = n ? 1e-6 / n : 0;
+        fprintf(f, "%.3f,%llu,%.2f,%.2f,%llu,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                std::chrono::duration<double>(now - begin).count(), (unsigned long long)emulated,
+                emulated_n / elapsed, n / elapsed,
+                (unsigned long long)(emulated_n ? (instrs - last_instrs) / emulated_n : 0),
+                (frame - last_frame) * per_frame, (cpu - last_cpu) * per_frame, (render - last_render) * per_frame,
+                (present - last_present) * per_frame, (sleep - last_sleep) * per_frame);
+        fflush(f);
+
+        last_time = now;
+        last_frames = frames;
+        last_emulated = emulated;
+        last_instrs = instrs;
+        last_frame = frame;
+        last_cpu = cpu;
+        last_render = render;
+        last_present = present;
+        last_sleep = sleep;
+    }
+    fclose(f);
+}
+
+// 3x5 pixel font, each glyph is 5 rows of 3 bits with the leftmost pixel in the high bit
+const std::string FONT_CHARS = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/%- ";
+const std::array<uint16_t, 42> FONT_GLYPHS = {
+    0b111'101'101'101'111, 0b010'110'010'010'111, 0b111'001'111'100'111, 0b111'001'111'001'111,
+    0b101'101'111'001'001, 0b111'100'111'001'111, 0b111'100'111'101'111, 0b111'001'001'001'001,
+    0b111'101'111'101'111, 0b111'101'111'001'111,
+    0b010'101'111'101'101, 0b110'101'110'101'110, 0b011'100'100'100'011, 0b110'101'101'101'110,
+    0b111'100'110'100'111, 0b111'100'110'100'100, 0b011'100'101'101'011, 0b101'101'111'101'101,
+    0b111'010'010'010'111, 0b001'001'001'101'010, 0b101'101'110'101'101, 0b100'100'100'100'111,
+    0b101'111'111'101'101, 0b110'101'101'101'101, 0b010'101'101'101'010, 0b110'101'110'100'100,
+    0b010'101'101'110'011, 0b110'101'110'101'101, 0b011'100'010'001'110, 0b111'010'010'010'010,
+    0b101'101'101'101'111, 0b101'101'101'101'010, 0b101'101'111'111'101, 0b101'101'010'101'101,
+    0b101'101'010'010'010, 0b111'001'010'100'111,
+    0b000'000'000'000'010, 0b000'010'000'010'000, 0b001'001'010'100'100, 0b101'001'010'100'101,
+    0b000'000'111'000'000, 0b000'000'000'000'000,
+};
+
+static void put_pixel(std::vector<uint8_t>& pixels, int x, int y, uint8_t shade) {
+    if (x < 0 || x >= GAMEBOY_DISPLAY_WIDTH || y < 0 || y >= GAMEBOY_DISPLAY_HEIGHT)
+        return;
+    int i = 4 * (GAMEBOY_DISPLAY_WIDTH * y + x);
+    pixels[i] = shade;
+    pixels[i + 1] = shade;
+    pixels[i + 2] = shade;
+    pixels[i + 3] = 255;
+}
+
+static void draw_text(std::vector<uint8_t>& pixels, int x, int y, const std::string& text) {
+    // dark box behind the text so it stays readable over any background
+    for (int j = -1; j < 6; j++) {
+        for (int i = -1; i < (int)text.size() * 4; i++)
+            put_pixel(pixels, x + i, y + j, 0);
+    }
+    for (size_t c = 0; c < text.size(); c++) {
+        size_t index = FONT_CHARS.find(text[c]);
+        if (index == std::string::npos)
+            continue;
+        uint16_t glyph = FONT_GLYPHS[index];
+        for (int row = 0; row < 5; row++) {
+            for (int col = 0; col < 3; col++) {
+                if ((glyph >> (14 - row * 3 - col)) & 1)
+                    put_pixel(pixels, x + c * 4 + col, y + row, 255);
+            }
+        }
+    }
+}
+
+void draw_stats_overlay(std::vector<uint8_t>& pixels, const Stats& stats) {
+    auto ms = [](const std::atomic<uint64_t>& ns) { return ns.load(std::memory_order_relaxed) / 1e6; };
+    uint64_t frame_ns = stats.avg_frame_ns.load(std::memory_order_relaxed);
+    uint64_t emulated_ns = stats.avg_emulated_frame_ns.load(std::memory_order_relaxed);
+    char line[48];
+
+    // FPS of the game, HOST is frames presented (they differ in fast-forward)
+    snprintf(line, sizeof(line), "FPS %.1f HOST %.1f IPF %llu", emulated_ns ? 1e9 / emulated_ns : 0.0,
+             frame_ns ? 1e9 / frame_ns : 0.0,
+             (unsigned long long)stats.last_instructions.load(std::memory_order_relaxed));
+    draw_text(pixels, 1, 1, line);
+    snprintf(line, sizeof(line), "CPU %.2f REN %.2f", ms(stats.avg_cpu_ns), ms(stats.avg_render_ns));
+    draw_text(pixels, 1, 8, line);
+    snprintf(line, sizeof(line), "PRE %.2f SLP %.2f", ms(stats.avg_present_ns), ms(stats.avg_sleep_ns));
+    draw_text(pixels, 1, 15, line);
+}
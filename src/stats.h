@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runtime counters written by the emulation thread once per host frame. They
+// are plain relaxed atomics so a reporter thread can read them without
+// locking and without ever stalling the frame loop.
+//
+// A host frame (one present) runs one emulated frame normally and a whole
+// batch of them in fast-forward, so the two are counted separately: the
+// times are per host frame, FPS and instructions per frame are per emulated
+// frame.
+class Stats {
+ public:
+    Stats();
+
+    void record_frame(uint64_t cpu_ns, uint64_t render_ns, uint64_t present_ns, uint64_t sleep_ns,
+                      uint64_t frame_ns, uint64_t instructions, uint64_t emulated_frames);
+
+    // host frames
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> emulated_frames;
+    std::atomic<uint64_t> instructions;
+    std::atomic<uint64_t> cpu_ns;
+    std::atomic<uint64_t> render_ns;
+    std::atomic<uint64_t> present_ns;
+    std::atomic<uint64_t> sleep_ns;
+    std::atomic<uint64_t> frame_ns;
+
+    // smoothed per-frame values for display
+    std::atomic<uint64_t> avg_frame_ns;
+    std::atomic<uint64_t> avg_cpu_ns;
+    std::atomic<uint64_t> avg_render_ns;
+    std::atomic<uint64_t> avg_present_ns;
+    std::atomic<uint64_t> avg_sleep_ns;
+    std::atomic<uint64_t> avg_emulated_frame_ns;
+    // per emulated frame, of the last host frame
+    std::atomic<uint64_t> last_instructions;
+};
+
+// Appends a CSV line of interval averages to a file every interval_ms from
+// its own thread, so nothing is written from the frame loop.
+class StatsWriter {
+ public:
+    StatsWriter(Stats& stats);
+    ~StatsWriter();
+    bool start(std::string filepath, int interval_ms);
+    void stop();
+
+ private:
+    Stats& stats;
+    std::atomic<bool> running;
+    std::thread thread;
+    void loop(FILE* f, int interval_ms);
+};
+
+// Draws a few lines of stats in the top-left corner of a 160x144 ARGB8888 frame.
+void draw_stats_overlay(std::vector<uint8_t>& pixels, const Stats& stats);
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "headless.h"
+#include "test_runner.h"
+
+struct TestResult {
+    std::string rom;
+    std::string status;
+    std::string message;
+    std::string output;
+    long frames;
+    double seconds;
+};
+
+static bool is_fibonacci(const Registers& r) {
+    return r.B == 3 && r.C == 5 && r.D == 8 && r.E == 13 && r.H == 21 && r.L == 34;
+}
+
+static bool is_mooneye_failure(const Registers& r) {
+    return r.B == 0x42 && r.C == 0x42 && r.D == 0x42 && r.E == 0x42 && r.H == 0x42 && r.L == 0x42;
+}
+
+// blargg roms that can't rely on serial write 0x80 to 0xA000 while running, then the result
+// code, with the signature DE B0 61 at 0xA001 and a zero terminated message from 0xA004
+static bool check_memory_result(Gameboy& gameboy, TestResult& result) {
+    if (gameboy.read_mmu(0xA001) != 0xDE || gameboy.read_mmu(0xA002) != 0xB0 || gameboy.read_mmu(0xA003) != 0x61)
+        return false;
+    uint8_t code = gameboy.read_mmu(0xA000);
+    if (code == 0x80)
+        return false;
+    std::string text;
+    for (int address = 0xA004; address < 0xC000; address++) {
+        uint8_t c = gameboy.read_mmu(address);
+        if (c == 0)
+            break;
+        text.push_back(c);
+    }
+    result.output = text;
+    result.status = code == 0 ? "pass" : "fail";
+    if (code != 0)
+        result.message = "result code " + std::to_string(code);
+    return true;
+}
+
+static TestResult run_test_rom(const std::string& path, long timeout_frames) {
+    TestResult result;
+    result.rom = path;
+    result.frames = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<HeadlessMachine> machine;
+    try {
+        machine = std::make_unique<HeadlessMachine>(path);
+        Gameboy& gameboy = machine->gameboy;
+        CPU& cpu = machine->gameboy.cpu;
+
+        while (result.status.empty()) {
+            machine->run_frame();
+            result.frames++;
+
+            if (cpu.ld_b_b_executed) {
+                cpu.ld_b_b_executed = false;
+                if (is_fibonacci(cpu.registers)) {
+                    result.status = "pass";
+                } else if (is_mooneye_failure(cpu.registers)) {
+                    result.status = "fail";
+                    result.message = "mooneye failure registers";
+                }
+            }
+            if (result.status.empty()) {
+                if (gameboy.serial_output.find("Passed") != std::string::npos) {
+                    result.status = "pass";
+                } else if (gameboy.serial_output.find("Failed") != std::string::npos) {
+                    result.status = "fail";
+                    result.message = "serial output reported failure";
+                } else if (!check_memory_result(gameboy, result) && result.frames >= timeout_frames) {
+                    result.status = "timeout";
+                    result.message = "no result after " + std::to_string(result.frames) + " frames";
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        result.status = "error";
+        result.message = e.what();
+    }
+
+    if (result.output.empty() && machine)
+        result.output = machine->gameboy.serial_output;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+static std::string escape(const std::string& s, bool xml) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (xml && c == '<') out += "&lt;";
+        else if (xml && c == '>') out += "&gt;";
+        else if (xml && c == '&') out += "&amp;";
+        else if (xml && c == '"') out += "&quot;";
+        else if (!xml && c == '"') out += "\\\"";
+        else if (!xml && c == '\\') out += "\\\\";
+        else if (!xml && c == '\n') out += "\\n";
+        else if (c < 0x20 && c != '\n') out += xml ? "" : "?";
+        else if (c >= 0x80) out += "?";
+        else out += c;
+    }
+    return out;
+}
+
+static void write_junit(FILE* f, const std::vector<TestResult>& results, double seconds) {
+    int failures = 0, errors = 0;
+    for (const TestResult& r : results) {
+        failures += r.status == "fail" || r.status == "timeout";
+        errors += r.status == "error";
+    }
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(f, "<testsuite name=\"test-roms\" tests=\"%zu\" failures=\"%d\" errors=\"%d\" time=\"%.3f\">\n",
+            results.size(), failures, errors, seconds);
+    for (const TestResult& r : results) {
+        fprintf(f, "  <testcase name=\"%s\" time=\"%.3f\">\n", escape(r.rom, true).c_str(), r.seconds);
+        if (r.status == "fail" || r.status == "timeout")
+            fprintf(f, "    <failure message=\"%s\">%s</failure>\n", escape(r.status + ": " + r.message, true).c_str(),
+                    escape(r.output, true).c_str());
+        else if (r.status == "error")
+            fprintf(f, "    <error message=\"%s\"/>\n", escape(r.message, true).c_str());
+        fprintf(f, "    <system-out>%s</system-out>\n  </testcase>\n", escape(r.output, true).c_str());
+    }
+    fprintf(f, "</testsuite>\n");
+}
+
+static void write_json(FILE* f, const std::vector<TestResult>& results, double seconds) {
+    fprintf(f, "{\n  \"seconds\": %.3f,\n  \"results\": [", seconds);
+    for (size_t i = 0; i < results.size(); i++) {
+        const TestResult& r = results[i];
+        fprintf(f, "%s\n    {\"rom\": \"%s\", \"status\": \"%s\", \"message\": \"%s\", \"frames\": %ld, "
+                "\"seconds\": %.3f, \"output\": \"%s\"}", i ? "," : "", escape(r.rom, false).c_str(),
+                r.status.c_str(), escape(r.message, false).c_str(), r.frames, r.seconds,
+                escape(r.output, false).c_str());
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int run_test_roms(const TestRunnerOptions& options) {
+    std::vector<std::string> roms;
+    try {
+        roms = find_roms(options.directory);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::vector<TestResult> results(roms.size());
+    auto start = std::chrono::steady_clock::now();
+    int jobs = run_parallel(roms.size(), options.jobs, [&](size_t index) {
+        results[index] = run_test_rom(roms[index], options.timeout_frames);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int passed = 0;
+    for (const TestResult& r : results) {
+        passed += r.status == "pass";
+        printf("%-7s %s (%ld frames, %.2fs)%s%s\n", r.status.c_str(), r.rom.c_str(), r.frames, r.seconds,
+               r.message.empty() ? "" : ": ", r.message.c_str());
+    }
+    printf("%d/%zu passed in %.2fs using %d threads\n", passed, results.size(), seconds, jobs);
+
+    if (!options.report.empty()) {
+        FILE* f = fopen(options.report.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "could not open %s\n", options.report.c_str());
+        } else {
+            bool xml = options.report.size() >= 4 && options.report.compare(options.report.size() - 4, 4, ".xml") == 0;
+            if (xml)
+                write_junit(f, results, seconds);
+            else
+                write_json(f, results, seconds);
+            fclose(f);
+        }
+    }
+
+    return passed == (int)results.size() ? 0 : 1;
+}
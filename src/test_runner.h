@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+struct TestRunnerOptions {
+    std::string directory;
+    int jobs = 0;
+    long timeout_frames = 60 * 60;
+    // .xml for JUnit, anything else for JSON
+    std::string report;
+};
+
+// Runs every .gb/.gbc under a directory headless, in parallel, and decides
+// pass/fail from the serial port (blargg), the 0xA000 result signature
+// (blargg, newer roms) or the ld b,b + Fibonacci registers convention
+// (mooneye). Returns the process exit code: 0 if every rom passed.
+int run_test_roms(const TestRunnerOptions& options);
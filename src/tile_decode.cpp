@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <cstring>
+
+#include "tile_decode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GB_X86 1
+#include <immintrin.h>
+#endif
+
+void palette_colors(uint8_t palette, uint32_t* out) {
+    // shade 0 is white, 3 is black
+    static const uint32_t SHADES[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
+    for (int color = 0; color < 4; color++)
+        out[color] = SHADES[(palette >> (2 * color)) & 3];
+}
+
+static void decode_rows_scalar(const uint8_t* planes, int count, const uint32_t* palette, uint32_t* argb,
+                               uint8_t* colors) {
+    for (int row = 0; row < count; row++) {
+        int lo = planes[2 * row];
+        int hi = planes[2 * row + 1];
+        for (int i = 0; i < 8; i++) {
+            int color = (((hi >> (7 - i)) & 1) << 1) | ((lo >> (7 - i)) & 1);
+            colors[8 * row + i] = color;
+            argb[8 * row + i] = palette[color];
+        }
+    }
+}
+
+#ifdef GB_X86
+
+// the 8 color numbers of a row as 16 bit lanes: broadcast each plane, keep one
+// bit per lane, compare to get all ones where it was set
+static inline __m128i decode_row_sse2(int lo, int hi) {
+    const __m128i bits = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    __m128i lo_set = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(lo), bits), bits);
+    __m128i hi_set = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(hi), bits), bits);
+    return _mm_or_si128(_mm_and_si128(lo_set, _mm_set1_epi16(1)), _mm_and_si128(hi_set, _mm_set1_epi16(2)));
+}
+
+// SSE2 has no variable shuffle, so the palette lookup is a select per color number
+static inline __m128i lookup_sse2(__m128i color, const __m128i* entries) {
+    __m128i out = _mm_and_si128(_mm_cmpeq_epi32(color, _mm_setzero_si128()), entries[0]);
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(color, _mm_set1_epi32(1)), entries[1]));
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(color, _mm_set1_epi32(2)), entries[2]));
+    out = _mm_or_si128(out, _mm_and_si128(_mm_cmpeq_epi32(color, _mm_set1_epi32(3)), entries[3]));
+    return out;
+}
+
+static void decode_rows_sse2(const uint8_t* planes, int count, const uint32_t* palette, uint32_t* argb,
+                             uint8_t* colors) {
+    const __m128i entries[4] = {_mm_set1_epi32(palette[0]), _mm_set1_epi32(palette[1]),
+                                _mm_set1_epi32(palette[2]), _mm_set1_epi32(palette[3])};
+    for (int row = 0; row < count; row++) {
+        __m128i color = decode_row_sse2(planes[2 * row], planes[2 * row + 1]);
+        _mm_storel_epi64((__m128i*)&colors[8 * row], _mm_packus_epi16(color, color));
+        __m128i left = _mm_unpacklo_epi16(color, _mm_setzero_si128());
+        __m128i right = _mm_unpackhi_epi16(color, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i*)&argb[8 * row], lookup_sse2(left, entries));
+        _mm_storeu_si128((__m128i*)&argb[8 * row + 4], lookup_sse2(right, entries));
+    }
+}
+
+// same decode, then the palette is a single cross lane shuffle of all 8 pixels
+__attribute__((target("avx2")))
+static void decode_rows_avx2(const uint8_t* planes, int count, const uint32_t* palette, uint32_t* argb,
+                             uint8_t* colors) {
+    const __m256i entries = _mm256_setr_epi32(palette[0], palette[1], palette[2], palette[3], 0, 0, 0, 0);
+    for (int row = 0; row < count; row++) {
+        __m128i color = decode_row_sse2(planes[2 * row], planes[2 * row + 1]);
+        _mm_storel_epi64((__m128i*)&colors[8 * row], _mm_packus_epi16(color, color));
+        __m256i pixels = _mm256_permutevar8x32_epi32(entries, _mm256_cvtepu16_epi32(color));
+        _mm256_storeu_si256((__m256i*)&argb[8 * row], pixels);
+    }
+}
+
+#endif
+
+DecodeRows decode_rows_kernel(DecodeKernel kernel) {
+    switch (kernel) {
+    case DecodeKernel::scalar:
+        return decode_rows_scalar;
+#ifdef GB_X86
+    case DecodeKernel::sse2:
+        return decode_rows_sse2;
+    case DecodeKernel::avx2:
+        // this also runs from a static initializer, before the runtime would have called it
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? decode_rows_avx2 : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const char* decode_kernel_name(DecodeKernel kernel) {
+    switch (kernel) {
+    case DecodeKernel::sse2:
+        return "sse2";
+    case DecodeKernel::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+bool decode_kernel_from_name(const std::string& name, DecodeKernel& kernel) {
+    for (DecodeKernel candidate : {DecodeKernel::scalar, DecodeKernel::sse2, DecodeKernel::avx2}) {
+        if (name == decode_kernel_name(candidate)) {
+            kernel = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+DecodeKernel best_decode_kernel() {
+    static const DecodeKernel best = [] {
+        if (decode_rows_kernel(DecodeKernel::avx2))
+            return DecodeKernel::avx2;
+        if (decode_rows_kernel(DecodeKernel::sse2))
+            return DecodeKernel::sse2;
+        return DecodeKernel::scalar;
+    }();
+    return best;
+}
+
+DecodeRows decode_rows = decode_rows_kernel(best_decode_kernel());
+
+bool set_decode_kernel(DecodeKernel kernel) {
+    DecodeRows rows = decode_rows_kernel(kernel);
+    if (!rows)
+        return false;
+    decode_rows = rows;
+    return true;
+}
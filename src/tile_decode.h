@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Turns rows of tile data into pixels. A row is 8 pixels stored as two bit
+// planes (lo, hi), leftmost pixel in bit 7, giving a 2 bit color number per
+// pixel. The color number goes through a 4 entry palette of ARGB8888 values
+// (the shades BGP picks for the frame).
+//
+// planes holds count rows as lo,hi byte pairs. Writes 8 * count pixels to argb
+// and their color numbers to colors (objects need those for background priority).
+using DecodeRows = void (*)(const uint8_t* planes, int count, const uint32_t* palette, uint32_t* argb,
+                            uint8_t* colors);
+
+enum class DecodeKernel { scalar, sse2, avx2 };
+
+// null if the kernel isn't built in or the cpu doesn't have it
+DecodeRows decode_rows_kernel(DecodeKernel kernel);
+const char* decode_kernel_name(DecodeKernel kernel);
+// false for an unknown name
+bool decode_kernel_from_name(const std::string& name, DecodeKernel& kernel);
+// the fastest one the cpu supports, picked once at startup
+DecodeKernel best_decode_kernel();
+
+// what the renderer calls, best_decode_kernel() unless overridden (for benchmarks)
+extern DecodeRows decode_rows;
+// false if the cpu can't run it
+bool set_decode_kernel(DecodeKernel kernel);
+
+// the 4 ARGB8888 colors a palette register (BGP, OBP0, OBP1) maps color numbers 0-3 to
+void palette_colors(uint8_t palette, uint32_t* out);
@@ -0,0 +1,257 @@
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ppu.h"
+#include "upscale.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GB_X86 1
+#include <emmintrin.h>
+#endif
+
+const int W = GAMEBOY_DISPLAY_WIDTH;
+const int H = GAMEBOY_DISPLAY_HEIGHT;
+
+const char* scale_filter_name(ScaleFilter filter) {
+    switch (filter) {
+    case ScaleFilter::scale2x:
+        return "scale2x";
+    case ScaleFilter::lcd:
+        return "lcd";
+    default:
+        return "nearest";
+    }
+}
+
+bool scale_filter_from_name(const std::string& name, ScaleFilter& filter) {
+    for (ScaleFilter candidate : {ScaleFilter::nearest, ScaleFilter::scale2x, ScaleFilter::lcd}) {
+        if (name == scale_filter_name(candidate)) {
+            filter = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool scale_supported(ScaleFilter filter, int scale) {
+    if (scale < 2 || scale > MAX_SCALE)
+        return false;
+    return filter != ScaleFilter::scale2x || scale % 2 == 0;
+}
+
+// 3/4 of each color channel, the alpha byte stays. c - c / 4 never borrows from the next byte
+static uint32_t darken(uint32_t argb) {
+    return argb - ((argb >> 2) & 0x003F3F3F);
+}
+
+// width * scale pixels into dst, which must have room for 3 more (the vector stores overshoot)
+static void nearest_row(const uint32_t* src, int width, int scale, uint32_t* dst, bool simd) {
+#ifdef GB_X86
+    if (simd) {
+        // broadcast each pixel to a vector and store it over its block, for scales above 4 twice
+        // (overlapping), the part that spills into the next block gets overwritten by that pixel
+        for (int x = 0; x < width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&src[x]);
+            __m128i p[4] = {_mm_shuffle_epi32(v, 0x00), _mm_shuffle_epi32(v, 0x55), _mm_shuffle_epi32(v, 0xAA),
+                            _mm_shuffle_epi32(v, 0xFF)};
+            for (int i = 0; i < 4; i++) {
+                uint32_t* block = &dst[(x + i) * scale];
+                _mm_storeu_si128((__m128i*)block, p[i]);
+                if (scale > 4)
+                    _mm_storeu_si128((__m128i*)&block[scale - 4], p[i]);
+            }
+        }
+        return;
+    }
+#endif
+    for (int x = 0; x < width; x++) {
+        for (int k = 0; k < scale; k++)
+            dst[x * scale + k] = src[x];
+    }
+}
+
+static void darken_row(const uint32_t* src, int width, uint32_t* dst, bool simd) {
+    int x = 0;
+#ifdef GB_X86
+    if (simd) {
+        const __m128i mask = _mm_set1_epi32(0x003F3F3F);
+        for (; x + 4 <= width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)&src[x]);
+            _mm_storeu_si128((__m128i*)&dst[x], _mm_sub_epi32(v, _mm_and_si128(_mm_srli_epi32(v, 2), mask)));
+        }
+    }
+#endif
+    for (; x < width; x++)
+        dst[x] = darken(src[x]);
+}
+
+#ifdef GB_X86
+static inline __m128i select(__m128i condition, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(condition, a), _mm_andnot_si128(condition, b));
+}
+#endif
+
+// Scale2x of one source row into two output rows. up and down are the rows above and
+// below (clamped at the edges), padded is the row itself with its edge pixels repeated
+// on both sides, so padded[x] is the left neighbour of pixel x and padded[x + 2] the right one.
+//
+//   . B .     E0 E1
+//   D E F  -> E2 E3
+//   . H .
+static void scale2x_row(const uint32_t* up, const uint32_t* padded, const uint32_t* down, int width,
+                        uint32_t* out0, uint32_t* out1, bool simd) {
+    int x = 0;
+#ifdef GB_X86
+    if (simd) {
+        for (; x + 4 <= width; x += 4) {
+            __m128i b = _mm_loadu_si128((const __m128i*)&up[x]);
+            __m128i h = _mm_loadu_si128((const __m128i*)&down[x]);
+            __m128i d = _mm_loadu_si128((const __m128i*)&padded[x]);
+            __m128i e = _mm_loadu_si128((const __m128i*)&padded[x + 1]);
+            __m128i f = _mm_loadu_si128((const __m128i*)&padded[x + 2]);
+            __m128i db = _mm_cmpeq_epi32(d, b);
+            __m128i bf = _mm_cmpeq_epi32(b, f);
+            __m128i dh = _mm_cmpeq_epi32(d, h);
+            __m128i hf = _mm_cmpeq_epi32(h, f);
+            // andnot(a, b) is !a && b
+            __m128i e0 = select(_mm_andnot_si128(bf, _mm_andnot_si128(dh, db)), d, e);
+            __m128i e1 = select(_mm_andnot_si128(db, _mm_andnot_si128(hf, bf)), f, e);
+            __m128i e2 = select(_mm_andnot_si128(db, _mm_andnot_si128(hf, dh)), d, e);
+            __m128i e3 = select(_mm_andnot_si128(dh, _mm_andnot_si128(bf, hf)), f, e);
+            _mm_storeu_si128((__m128i*)&out0[2 * x], _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128((__m128i*)&out0[2 * x + 4], _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128((__m128i*)&out1[2 * x], _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128((__m128i*)&out1[2 * x + 4], _mm_unpackhi_epi32(e2, e3));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        uint32_t b = up[x], h = down[x], d = padded[x], e = padded[x + 1], f = padded[x + 2];
+        out0[2 * x] = d == b && b != f && d != h ? d : e;
+        out0[2 * x + 1] = b == f && b != d && f != h ? f : e;
+        out1[2 * x] = d == h && d != b && h != f ? d : e;
+        out1[2 * x + 1] = h == f && d != h && b != f ? f : e;
+    }
+}
+
+void upscale(ScaleFilter filter, int scale, const uint32_t* src, uint32_t* dst, bool simd) {
+    int out_width = W * scale;
+    size_t row_bytes = out_width * sizeof(uint32_t);
+    // scratch rows, all of them together are a few KB
+    std::array<uint32_t, W * MAX_SCALE + 4> row;
+    std::array<uint32_t, W * MAX_SCALE + 4> grid;
+    uint32_t* out = dst;
+
+    if (filter == ScaleFilter::nearest) {
+        for (int y = 0; y < H; y++) {
+            nearest_row(&src[y * W], W, scale, row.data(), simd);
+            for (int k = 0; k < scale; k++, out += out_width)
+                std::memcpy(out, row.data(), row_bytes);
+        }
+    } else if (filter == ScaleFilter::lcd) {
+        std::array<uint32_t, W> dark;
+        for (int y = 0; y < H; y++) {
+            darken_row(&src[y * W], W, dark.data(), simd);
+            nearest_row(&src[y * W], W, scale, row.data(), simd);
+            nearest_row(dark.data(), W, scale, grid.data(), simd);
+            for (int x = 0; x < W; x++)
+                row[x * scale + scale - 1] = dark[x];
+            for (int k = 0; k < scale - 1; k++, out += out_width)
+                std::memcpy(out, row.data(), row_bytes);
+            std::memcpy(out, grid.data(), row_bytes);
+            out += out_width;
+        }
+    } else {
+        // Scale2x to twice the size, anything above that is nearest on top
+        int factor = scale / 2;
+        std::array<uint32_t, W + 2> padded;
+        std::array<std::array<uint32_t, 2 * W>, 2> pair;
+        for (int y = 0; y < H; y++) {
+            const uint32_t* up = &src[(y > 0 ? y - 1 : y) * W];
+            const uint32_t* down = &src[(y < H - 1 ? y + 1 : y) * W];
+            std::memcpy(&padded[1], &src[y * W], W * sizeof(uint32_t));
+            padded[0] = padded[1];
+            padded[W + 1] = padded[W];
+            scale2x_row(up, padded.data(), down, W, pair[0].data(), pair[1].data(), simd);
+            for (auto& half : pair) {
+                const uint32_t* line = half.data();
+                if (factor > 1) {
+                    nearest_row(half.data(), 2 * W, factor, row.data(), simd);
+                    line = row.data();
+                }
+                for (int k = 0; k < factor; k++, out += out_width)
+                    std::memcpy(out, line, row_bytes);
+            }
+        }
+    }
+}
+
+Upscaler::Upscaler() : filter(ScaleFilter::nearest), scale(1), running(false), pending(false) {
+}
+
+Upscaler::~Upscaler() {
+    stop();
+}
+
+void Upscaler::start(ScaleFilter filter, int scale) {
+    stop();
+    this->filter = filter;
+    this->scale = scale;
+    input.assign(W * H, 0);
+    output.assign(W * H * scale * scale, 0);
+    running = true;
+    pending = false;
+    thread = std::thread(&Upscaler::loop, this);
+}
+
+void Upscaler::stop() {
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+int Upscaler::width() const {
+    return W * scale;
+}
+
+int Upscaler::height() const {
+    return H * scale;
+}
+
+void Upscaler::submit(const std::vector<uint8_t>& pixels) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(input.data(), pixels.data(), input.size() * sizeof(uint32_t));
+        pending = true;
+    }
+    changed.notify_all();
+}
+
+const std::vector<uint32_t>& Upscaler::result() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return !pending; });
+    return output;
+}
+
+void Upscaler::loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this] { return !running || pending; });
+        if (!running)
+            break;
+        // the frame loop only submits again after collecting the result, so nobody else
+        // wants the lock while this runs
+        upscale(filter, scale, input.data(), output.data());
+        pending = false;
+        changed.notify_all();
+    }
+}
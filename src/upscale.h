@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Software upscaling of the 160x144 ARGB8888 frame for the window, so it
+// doesn't depend on how well the SDL renderer's driver scales.
+//
+//   nearest  every pixel becomes a scale x scale block (2x-6x)
+//   scale2x  Scale2x/EPX, rounds diagonal edges (2x, 4x and 6x: Scale2x, then nearest)
+//   lcd      nearest with the last row and column of each block darkened like the
+//            gaps between the pixels of the real LCD (2x-6x)
+//
+// Every filter works one source row at a time: the scaled row (or pair of rows
+// for scale2x) is built once in a scratch buffer that stays in L1, and copied
+// out for each output row it covers. The row kernels use SSE2 on x86 and plain
+// loops elsewhere.
+enum class ScaleFilter { nearest, scale2x, lcd };
+
+const int MAX_SCALE = 6;
+
+const char* scale_filter_name(ScaleFilter filter);
+// false for an unknown name
+bool scale_filter_from_name(const std::string& name, ScaleFilter& filter);
+bool scale_supported(ScaleFilter filter, int scale);
+
+// dst is (160 * scale) x (144 * scale), simd = false forces the plain loops (benchmarks, equivalence checks)
+void upscale(ScaleFilter filter, int scale, const uint32_t* src, uint32_t* dst, bool simd = true);
+
+// Runs upscale() on its own thread. The frame loop submits a rendered frame
+// right after drawing it and only collects the result when presenting, so
+// the scaling overlaps everything in between and never runs on the
+// emulation thread.
+class Upscaler {
+ public:
+    Upscaler();
+    ~Upscaler();
+    void start(ScaleFilter filter, int scale);
+    void stop();
+    bool is_running() const { return thread.joinable(); }
+    int width() const;
+    int height() const;
+
+    // pixels in the renderer's BGRA layout, copied before returning
+    void submit(const std::vector<uint8_t>& pixels);
+    // waits for the last submitted frame
+    const std::vector<uint32_t>& result();
+
+ private:
+    ScaleFilter filter;
+    int scale;
+    std::vector<uint32_t> input;
+    std::vector<uint32_t> output;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool running;
+    bool pending;
+    std::thread thread;
+
+    void loop();
+};